@@ -0,0 +1,110 @@
+// Cloud density at a sample point, pasted into shaders with #include "density.glsl". Expects cloudScale
+// and cloudOffset to be declared. PROCEDURAL_DENSITY evaluates the Worley channels in place, otherwise
+// the shape and detail volumes or the baked density are sampled. OpaqueDensity is where the marches
+// summing these densities can stop.
+
+const float DensityThreshold = 0.75f; // Density below this is air, DensityThreshold in Application.cpp matches it
+uniform float transmittanceEpsilon;   // Marches stop once less light than this gets through
+
+#ifdef PROCEDURAL_DENSITY
+uniform ivec4 noiseFrequency; // Cells per unit of uvw: shape r, g, then detail r, g
+uniform ivec4 noiseSeed;      // Hashed seed of each of those channels
+uniform vec4 noiseRange;      // Largest squared distance of each channel in cells, what the Worley volumes remap by
+
+uint Hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+float Random(uint channelSeed, ivec3 cell, uint counter)
+{
+    uint h = Hash(counter + channelSeed);
+    h = Hash(h ^ uint(cell.x));
+    h = Hash(h ^ uint(cell.y));
+    h = Hash(h ^ uint(cell.z));
+    return float(h >> 8) * (1.0f / 16777216.0f);
+}
+float ProceduralWorley(vec3 uvw, int frequency, int seed, float maxDist)
+{
+    // Same feature points as the Worley volume inside its first period, but cells are never
+    // wrapped so the domain does not repeat. Distances are squared and in cells, normalized by
+    // maxDist, the range the CPU generator found for the volume's channel (see WorleyRange).
+    vec3 p = uvw * float(frequency);
+    ivec3 cell = ivec3(floor(p));
+
+    float dist = maxDist;
+    for (int kk = -1; kk <= 1; kk++)
+    {
+        for (int jj = -1; jj <= 1; jj++)
+        {
+            for (int ii = -1; ii <= 1; ii++)
+            {
+                ivec3 neighbour = cell + ivec3(ii, jj, kk);
+                if (Random(uint(seed), neighbour, 0U) > 0.6f) continue; // Empty cell
+                vec3 point = vec3(neighbour) + vec3(Random(uint(seed), neighbour, 1U), Random(uint(seed), neighbour, 2U), Random(uint(seed), neighbour, 3U));
+                vec3 d = p - point;
+                dist = min(dist, dot(d, d));
+            }
+        }
+    }
+    return 1.0f - dist / maxDist;
+}
+float DensityAtSamplePoint(vec3 samplePoint, float footprint)
+{
+    // Texture free variant: the four Worley channels are evaluated in place, no volume is sampled
+    vec3 uvw = (samplePoint + cloudOffset) * cloudScale;
+
+    float shapeDensity = pow(ProceduralWorley(uvw, noiseFrequency.x, noiseSeed.x, noiseRange.x) * ProceduralWorley(uvw, noiseFrequency.y, noiseSeed.y, noiseRange.y), 0.3f);
+    if (shapeDensity < DensityThreshold) return 0.0f;
+
+    float density = shapeDensity * pow(ProceduralWorley(uvw, noiseFrequency.z, noiseSeed.z, noiseRange.z) * ProceduralWorley(uvw, noiseFrequency.w, noiseSeed.w, noiseRange.w), 0.3f);
+    return density < DensityThreshold ? 0.0f : density;
+}
+#else
+uniform sampler3D shapeTexture;  // Low frequency Worley, 2 channels
+uniform sampler3D detailTexture; // High frequency Worley, 2 channels, tiled detailScale times
+uniform float detailScale;
+uniform sampler3D densityTexture; // Baked pow(shape * detail, 0.3), 1 channel
+uniform bool bakedDensity;
+uniform bool mipLod;        // Read coarser mips for samples with a wide footprint
+
+float MipLevel(sampler3D volume, float footprint, float tiling)
+{
+    // Level whose texels are as wide as the world space footprint of the sample
+    if (!mipLod) return 0.0f;
+    float texels = footprint * cloudScale * tiling * float(textureSize(volume, 0).x);
+    return max(log2(texels), 0.0f);
+}
+float DensityAtSamplePoint(vec3 samplePoint, float footprint)
+{
+    vec3 uvw = (samplePoint + cloudOffset) * cloudScale;
+
+    if (bakedDensity)
+    {
+        float bakedSample = textureLod(densityTexture, uvw, MipLevel(densityTexture, footprint, 1.0f)).r;
+        return bakedSample < DensityThreshold ? 0.0f : bakedSample;
+    }
+
+    // Every channel is at most 1, so if the shape alone is below the threshold the detail cannot lift it
+    vec2 shapeSample = textureLod(shapeTexture, uvw, MipLevel(shapeTexture, footprint, 1.0f)).rg;
+    float shapeDensity = pow(shapeSample.r * shapeSample.g, 0.3f);
+    if (shapeDensity < DensityThreshold) return 0.0f;
+
+    vec2 detailSample = textureLod(detailTexture, uvw * detailScale, MipLevel(detailTexture, footprint, detailScale)).rg;
+    float density = shapeDensity * pow(detailSample.r * detailSample.g, 0.3f);
+
+    if (density < DensityThreshold) density = 0.0f;
+    //if (density > 0.95f) density = 1.0f;
+
+    return density;
+}
+#endif
+// Summed density at which exp(-sum / densityPerDepth) lets less than transmittanceEpsilon through
+float OpaqueDensity(float densityPerDepth)
+{
+    return transmittanceEpsilon > 0.0f ? -log(transmittanceEpsilon) * densityPerDepth : 1e30f;
+}
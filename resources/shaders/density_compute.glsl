@@ -0,0 +1,27 @@
+#shader compute
+#version 430 core
+
+// Bakes pow(shape * detail, 0.3) into the density texture, the GPU side of DensityVolume
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 8) in;
+
+uniform sampler3D shapeTexture;
+uniform sampler3D detailTexture;
+uniform writeonly image3D densityImage;
+uniform int resolution;
+uniform float detailScale;
+uniform int firstSlice; // One slab of z slices per dispatch, starting here
+
+void main()
+{
+    ivec3 voxel = ivec3(gl_GlobalInvocationID) + ivec3(0, 0, firstSlice);
+    if (any(greaterThanEqual(voxel, ivec3(resolution)))) return;
+
+    // Voxel centres of the shape volume, the detail is sampled where the render shaders would
+    vec3 uvw = (vec3(voxel) + 0.5f) / float(resolution);
+    vec2 shapeSample = texelFetch(shapeTexture, voxel, 0).rg;
+    vec2 detailSample = textureLod(detailTexture, uvw * detailScale, 0.0f).rg;
+    float density = pow(shapeSample.r * shapeSample.g * detailSample.r * detailSample.g, 0.3f);
+
+    imageStore(densityImage, voxel, vec4(density, 0.0f, 0.0f, 0.0f));
+}
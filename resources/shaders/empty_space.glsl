@@ -0,0 +1,51 @@
+// Empty space skipping, pasted into shaders with #include "empty_space.glsl" after ray_box.glsl and
+// density.glsl. The bounds and occupancy grid come from MaxDensityGrid, the radii from DistanceField.
+
+uniform int skippingMode;        // Empty space: 0 fixed steps, 1 occupancy grid, 2 distance field
+uniform sampler3D occupancyGrid; // Upper bound of the density in each macro cell of the noise period
+uniform vec3 activeMin;          // Part of the box the density can reach, in world space
+uniform vec3 activeMax;
+uniform sampler3D distanceField; // Radius around each texel of the baked density with nothing over the threshold, in texels
+
+float EmptySpaceAhead(vec3 origin, vec3 direction, float maxDistance)
+{
+    // Length of the empty run the ray starts in, or minus the distance to the end of the occupied macro
+    // cell it starts in. Outside the active bounds the run lasts until the ray enters them, inside them
+    // a 3D DDA walks the occupancy grid, which tiles like the noise, or the distance field bounds the run.
+    if (skippingMode == 0) return -maxDistance;
+    if (any(greaterThan(activeMin, activeMax))) return maxDistance;
+
+    vec2 activeSpan = RayBoxDistances(origin, direction, activeMin, activeMax);
+    if (activeSpan.x > activeSpan.y) return maxDistance;
+    if (activeSpan.x > 0.0f) return min(activeSpan.x, maxDistance);
+
+    if (skippingMode == 2)
+    {
+        // Sphere tracing, 0 near clouds so the next sample checks again
+        float radius = texture(distanceField, (origin + cloudOffset) * cloudScale).r / (cloudScale * float(textureSize(distanceField, 0).x));
+        return min(radius, maxDistance);
+    }
+
+    ivec3 gridSize = textureSize(occupancyGrid, 0);
+    vec3 cellScale = cloudScale * vec3(gridSize);
+    vec3 p = (origin + cloudOffset) * cellScale;
+    ivec3 cell = ivec3(floor(p));
+    vec3 safeDirection = mix(direction, vec3(1e-6f), lessThan(abs(direction), vec3(1e-6f)));
+    ivec3 cellStep = ivec3(sign(safeDirection));
+    vec3 tDelta = abs(1.0f / safeDirection) / cellScale;
+    vec3 tNext = mix(p - vec3(cell), vec3(cell) + 1.0f - p, greaterThan(safeDirection, vec3(0.0f))) * tDelta;
+    float t = 0.0f;
+    for (int i = 0; i < 32; i++)
+    {
+        ivec3 wrapped = cell - gridSize * ivec3(floor(vec3(cell) / vec3(gridSize)));
+        float exit = min(tNext.x, min(tNext.y, tNext.z));
+        if (texelFetch(occupancyGrid, wrapped, 0).r >= DensityThreshold) return i == 0 ? -exit : t;
+        t = exit;
+        if (t >= maxDistance || t >= activeSpan.y) return maxDistance; // Nothing past the active bounds
+
+        if (tNext.x <= tNext.y && tNext.x <= tNext.z) { cell.x += cellStep.x; tNext.x += tDelta.x; }
+        else if (tNext.y <= tNext.z) { cell.y += cellStep.y; tNext.y += tDelta.y; }
+        else { cell.z += cellStep.z; tNext.z += tDelta.z; }
+    }
+    return t;
+}
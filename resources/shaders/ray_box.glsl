@@ -0,0 +1,16 @@
+// Ray and box helpers, pasted into shaders with #include "ray_box.glsl"
+
+vec2 RayBoxDistances(vec3 origin, vec3 direction, vec3 boxMin, vec3 boxMax)
+{
+    // Slab method: distances along direction to where the ray enters and leaves the box, without a
+    // branch per face. The entry is clamped to 0 when origin is inside; a miss has entry > exit.
+    vec3 safeDirection = mix(direction, vec3(1e-6f), lessThan(abs(direction), vec3(1e-6f)));
+    vec3 invDirection = 1.0f / safeDirection;
+    vec3 t0 = (boxMin - origin) * invDirection;
+    vec3 t1 = (boxMax - origin) * invDirection;
+    vec3 tNear = min(t0, t1);
+    vec3 tFar = max(t0, t1);
+    float entry = max(max(tNear.x, tNear.y), max(tNear.z, 0.0f));
+    float exit = min(tFar.x, min(tFar.y, tFar.z));
+    return vec2(entry, exit);
+}
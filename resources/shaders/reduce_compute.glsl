@@ -0,0 +1,65 @@
+#shader compute
+#version 430 core
+
+// Reduces a finished noise or density volume to what the host builds its skipping structures from, so
+// only these small buffers are read back instead of the volume. Pass 0 writes the largest r and g of
+// every MaxDensityGrid cell and its one texel halo, pass 1 packs which texels are over the density
+// threshold into bits for the DistanceField.
+
+layout(local_size_x = 64) in;
+
+layout(std430, binding = 0) buffer CellMaxima
+{
+    vec2 cellMax[]; // cells^3, x fastest
+};
+layout(std430, binding = 1) buffer Occupancy
+{
+    uint occupied[]; // Bit n of word w is texel 32 * w + n, x fastest
+};
+
+uniform sampler3D volume;
+uniform int resolution; // Texels along each side
+uniform int cells;      // MaxDensityGrid cells along each side
+uniform float threshold;
+uniform int pass;
+
+ivec3 Voxel(int index, int dim)
+{
+    return ivec3(index % dim, (index / dim) % dim, index / (dim * dim));
+}
+
+void main()
+{
+    int index = int(gl_GlobalInvocationID.x);
+
+    if (pass == 0)
+    {
+        if (index >= cells * cells * cells) return;
+        int cellTexels = resolution / cells;
+        ivec3 lo = Voxel(index, cells) * cellTexels - 1;
+
+        // Filtering reaches one texel past the cell, wrapped like the texture
+        vec2 maxima = vec2(0.0f);
+        for (int k = lo.z; k <= lo.z + cellTexels + 1; k++)
+        {
+            for (int j = lo.y; j <= lo.y + cellTexels + 1; j++)
+            {
+                for (int i = lo.x; i <= lo.x + cellTexels + 1; i++)
+                {
+                    maxima = max(maxima, texelFetch(volume, (ivec3(i, j, k) + resolution) % resolution, 0).rg);
+                }
+            }
+        }
+        cellMax[index] = maxima;
+        return;
+    }
+
+    int count = resolution * resolution * resolution;
+    if (32 * index >= count) return;
+    uint bits = 0U;
+    for (int n = 0; n < 32 && 32 * index + n < count; n++)
+    {
+        if (texelFetch(volume, Voxel(32 * index + n, resolution), 0).r >= threshold) bits |= 1U << n;
+    }
+    occupied[index] = bits;
+}
@@ -53,179 +53,22 @@ uniform float cloudScale;
 uniform float maxDensity;
 uniform vec3 cloudOffset;
 
-uniform sampler3D worleyTexture;
+uniform float pixelSpread;  // Width of a pixel at unit distance from the camera
+uniform sampler3D blueNoise;   // Blue noise ranks, one slice per frame when it has several
+uniform int blueNoiseFrame;
+uniform float jitterStrength;  // 0 keeps the fixed ray start offset
 
-float DensityAtSamplePoint(vec3 samplePoint)
+float RayJitter()
 {
-	//float density = 0.0f;
-	vec4 texSample = texture(worleyTexture, (samplePoint + cloudOffset) * cloudScale);
-
-	//if(texSample.a < 0.9) texSample.a = 0.0f;
-	//if(texSample.b < 0.8) texSample.b = 0.0f;
-	//if(texSample.g < 0.7) texSample.g = 0.0f;
-	//if(texSample.r < 0.6) texSample.r = 0.0f;
-
-
-	//float density = ((texSample.r) + (texSample.g) + (texSample.b) + (texSample.a)) / 4;
-	float density = pow(texSample.r * texSample.g * texSample.b * texSample.a, 0.3f);
-
-	if (density < 0.75f) density = 0.0f;
-	//if (density > 0.95f) density = 1.0f;
-
-	return density;
-}
-vec3 IntersectionWithCube(vec3 currentPosition, vec3 viewRay)
-{
-    // Find intersection with cube
-    viewRay = normalize(viewRay);
-    bool intersected = false;
-    vec3 intersectionPoint = vec3(-10000.0f, -10000.0f, -10000.0f);
-    float constant, query_1, query_2;
-
-
-    // int with z min
-    if (intersected == false)
-    {
-        if (viewRay.z != 0.0f)
-        {
-            constant = (cubeMin.z - currentPosition.z) / viewRay.z;
-
-            if (constant != 0.0f)
-            {
-                query_1 = currentPosition.x + (constant * viewRay.x);
-                query_2 = currentPosition.y + (constant * viewRay.y);
-
-                if ((query_1 > cubeMin.x) && (query_1 < cubeMax.x) && (query_2 > cubeMin.y) && (query_2 < cubeMax.y))
-                {
-                    intersected = true;
-                    intersectionPoint = vec3(query_1, query_2, cubeMin.z);
-                }
-            }
-
-        }
-
-    }
-    // int with x min
-    if (intersected == false)
-    {
-        if (viewRay.x != 0.0f)
-        {
-            constant = (cubeMin.x - currentPosition.x) / viewRay.x;
-
-            if (constant != 0.0f)
-            {
-                query_1 = currentPosition.y + (constant * viewRay.y);
-                query_2 = currentPosition.z + (constant * viewRay.z);
-
-                if ((query_1 > cubeMin.y) && (query_1 < cubeMax.y) && (query_2 > cubeMin.z) && (query_2 < cubeMax.z))
-                {
-                    intersected = true;
-                    intersectionPoint = vec3(cubeMin.x, query_1, query_2);
-                }
-            }
-
-        }
-
-    }
-
-    // int with y min
-    if (intersected == false)
-    {
-        if (viewRay.y != 0.0f)
-        {
-            constant = (cubeMin.y - currentPosition.y) / viewRay.y;
-
-            if (constant != 0.0f)
-            {
-                query_1 = currentPosition.x + (constant * viewRay.x);
-                query_2 = currentPosition.z + (constant * viewRay.z);
-
-                if ((query_1 > cubeMin.x) && (query_1 < cubeMax.x) && (query_2 > cubeMin.z) && (query_2 < cubeMax.z))
-                {
-                    intersected = true;
-                    intersectionPoint = vec3(query_1, cubeMin.y, query_2);
-                }
-            }
-
-        }
-
-    }
-
-    
-
-    // int with x max
-    if (intersected == false)
-    {
-        if (viewRay.x != 0.0f)
-        {
-            constant = (cubeMax.x - currentPosition.x) / viewRay.x;
-
-            if (constant != 0.0f)
-            {
-                query_1 = currentPosition.y + (constant * viewRay.y);
-                query_2 = currentPosition.z + (constant * viewRay.z);
-
-                if ((query_1 > cubeMin.y) && (query_1 < cubeMax.y) && (query_2 > cubeMin.z) && (query_2 < cubeMax.z))
-                {
-                    intersected = true;
-                    intersectionPoint = vec3(cubeMax.x, query_1, query_2);
-                }
-            }
-
-        }
-
-    }
-
-    // int with y max
-    if (intersected == false)
-    {
-        if (viewRay.y != 0.0f)
-        {
-            constant = (cubeMax.y - currentPosition.y) / viewRay.y;
-
-            if (constant != 0.0f)
-            {
-                query_1 = currentPosition.x + (constant * viewRay.x);
-                query_2 = currentPosition.z + (constant * viewRay.z);
-
-                if ((query_1 > cubeMin.x) && (query_1 < cubeMax.x) && (query_2 > cubeMin.z) && (query_2 < cubeMax.z))
-                {
-                    intersected = true;
-                    intersectionPoint = vec3(query_1, cubeMax.y, query_2);
-                }
-            }
-
-        }
-
-    }
-
-    // int with z max
-    if (intersected == false)
-    {
-        if (viewRay.z != 0.0f)
-        {
-            constant = (cubeMax.z - currentPosition.z) / viewRay.z;
-
-            if (constant != 0.0f)
-            {
-                query_1 = currentPosition.x + (constant * viewRay.x);
-                query_2 = currentPosition.y + (constant * viewRay.y);
-
-                if ((query_1 > cubeMin.x) && (query_1 < cubeMax.x) && (query_2 > cubeMin.y) && (query_2 < cubeMax.y))
-                {
-
-                    intersected = true;
-                    intersectionPoint = vec3(query_1, query_2, cubeMax.z);
-                }
-            }
-
-        }
-
-    }
-
-    return intersectionPoint;
+	// Ray start offset in [-0.5, 0.5) of a step, decorrelated between neighbouring pixels and frames
+	ivec3 size = textureSize(blueNoise, 0);
+	ivec3 texel = ivec3(ivec2(gl_FragCoord.xy) % size.xy, blueNoiseFrame % size.z);
+	return (texelFetch(blueNoise, texel, 0).r - 0.5f) * jitterStrength;
 }
 
+#include "ray_box.glsl"
+#include "density.glsl"
+#include "empty_space.glsl"
 vec4 PointLight()
 {	
 	// Attributes needed for Light Equation
@@ -262,24 +105,14 @@ vec4 CloudShadow()
         return vec4(1.0f, 1.0f, 1.0f, 1.0f);
     }
     
-    vec3 inPoint = IntersectionWithCube(currentPosition, viewRay);
-    
-    if (inPoint.x == -10000.0f) // No intersection with cloud
-    {
-        return vec4(1.0f, 1.0f, 1.0f, 1.0f);
-    }
-
-    if (length(inPoint - currentPosition) > length(lightPosition - currentPosition))
-    {
-        return vec4(1.0f, 1.0f, 1.0f, 1.0f);
-    }
-    // Intersected
-    vec3 outPoint = IntersectionWithCube(inPoint, viewRay);
-
-    if (outPoint.x == -10000.0f && outPoint != inPoint) // No intersection with cloud
+    // One slab test gives both where the ray to the light enters the cloud and where it leaves
+    vec2 span = RayBoxDistances(currentPosition, viewRay, cubeMin, cubeMax);
+    if (span.x >= span.y || span.x > length(lightPosition - currentPosition)) // No intersection with cloud, or it is past the light
     {
         return vec4(1.0f, 1.0f, 1.0f, 1.0f);
     }
+    vec3 inPoint = currentPosition + viewRay * span.x;
+    vec3 outPoint = currentPosition + viewRay * span.y;
 
     float totalDensity = 0.0f; 
     float lengthofIntersection = length(outPoint - inPoint);
@@ -303,14 +136,31 @@ vec4 CloudShadow()
     //float lightComingThrough = exp(-1 * (totalDensity * (maxDensity/5.0f) / (lengthofIntersection))); // Normalized density
 
     float max_maxDensity = (length(cubeMax - cubeMin) * shadow_samples) - 1; // Max Total points enclosed in segment
+    float opaqueDensity = OpaqueDensity(2.0f * max_maxDensity / maxDensity); // Past this the shadow is full
+    float jitter = RayJitter();
+    float stepLength = lengthofIntersection / numSamples;
+    float nextGridCheck = 0.0f; // Distance along the ray where the occupancy grid is read again
     for (int i = 1; i < int(numSamples); i++)
     {
-        float offset = i / numSamples;
+        float offset = (i + jitter) / numSamples;
         vec3 samplePoint = (1 - offset) * inPoint + (offset) * outPoint;
+        float distance = offset * lengthofIntersection;
+        if (distance >= nextGridCheck)
+        {
+            float run = EmptySpaceAhead(samplePoint, viewRay, lengthofIntersection - distance);
+            if (run > 0.0f)
+            {
+                // Every sample in the run has zero density
+                i += int(ceil(run / stepLength)) - 1;
+                continue;
+            }
+            nextGridCheck = distance - run;
+        }
 
-        float sampleDensity = DensityAtSamplePoint(samplePoint);
+        float footprint = max(dx, length(samplePoint - cameraPosition) * pixelSpread);
+        float sampleDensity = DensityAtSamplePoint(samplePoint, footprint);
         totalDensity += sampleDensity;
-
+        if (totalDensity > opaqueDensity) break;
 
     }
     float lightComingThrough = exp(-0.5f * (totalDensity / max_maxDensity) * maxDensity); // Normalized density
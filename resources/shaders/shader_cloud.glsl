@@ -13,15 +13,25 @@ uniform mat4 modelMatrix;
 uniform mat4 cameraMatrix;
 uniform vec3 cubeMinInitial;
 uniform vec3 cubeMaxInitial;
+uniform vec4 marchTransform; // Scale minus 1 and offset moving this frame's rays onto the target's texels, 0 for every ray
 
 void main()
 {
+    cubeMin = vec3(modelMatrix * vec4(cubeMinInitial, 1.0f));
+    cubeMax = vec3(modelMatrix * vec4(cubeMaxInitial, 1.0f));
+#ifdef LIGHT_VOLUME_PASS
+    // One triangle over the whole slice, drawn without vertex buffers
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    currentPosition = vec3(0.0f);
+    fragmentNormal = vec3(0.0f);
+    gl_Position = vec4(corner * 2.0f - 1.0f, 0.0f, 1.0f);
+#else
     currentPosition = vec3(modelMatrix * vec4(vertexPosition, 1.0f));
     fragmentNormal = vec3(modelMatrix * vec4(vertexNormal, 0.0f));
     //fragmentNormal = vertexNormal;
-    cubeMin = vec3(modelMatrix * vec4(cubeMinInitial, 1.0f));
-    cubeMax = vec3(modelMatrix * vec4(cubeMaxInitial, 1.0f));
     gl_Position = cameraMatrix * vec4(currentPosition, 1.0f);
+    gl_Position.xy += gl_Position.xy * marchTransform.xy + marchTransform.zw * gl_Position.w;
+#endif
 }
 
 
@@ -34,7 +44,8 @@ in vec3 fragmentNormal;
 in vec3 cubeMin;
 in vec3 cubeMax;
 
-out vec4 color;
+layout(location = 0) out vec4 color;
+layout(location = 1) out vec4 cloudDistance; // Camera to cloud distance weighted like its light, alpha 1 so blending replaces it
 
 uniform vec3 lightPosition;
 uniform vec4 lightColor;
@@ -53,189 +64,79 @@ uniform float falloff;
 uniform float cloudScale;
 uniform vec3 cloudOffset;
 
-uniform sampler3D worleyTexture;
+uniform float pixelSpread;  // Width of a pixel at unit distance from the camera
+uniform sampler3D blueNoise;   // Blue noise ranks, one slice per frame when it has several
+uniform int blueNoiseFrame;
+uniform float jitterStrength;  // 0 keeps the fixed ray start offset
+uniform float jitterRotation;  // Added to every rank, a new one each frame gives offsets the table's slices do not
+uniform bool useLightVolume;
+uniform sampler3D lightVolume; // Transmittance to the light over the box, written by the LIGHT_VOLUME_PASS variant
+uniform vec3 lightVolumeSize;
+uniform vec3 lightVolumeOrigin;   // Storage texel holding the box's first texel, the volume wraps around
+uniform vec3 lightVolumeResidual; // cloudOffset past the snapped origin, in uvw of the box
+uniform int lightMarchMode;         // 0 even steps out of the box, 1 a cone of ConeSamples and one long sample
+uniform int airStride;              // Samples stepped at once through air, back to 1 inside the cloud
+uniform bool temporalAccumulation;  // Frames with different jitter are averaged
+uniform mat4 cameraMatrix;
+uniform bool sceneDepthClamp;       // Rays end at the opaque scene
+uniform sampler2D depthPyramid;     // Nearest and farthest distance to the opaque scene, level 0 per viewport pixel
+uniform int rayDepthLevel;          // Pyramid level with a texel per ray footprint
+uniform int tileDepthLevel;         // Coarser level read first, covering a tile of rays
 
-vec3 IntersectionWithCube(vec3 currentPosition, vec3 viewRay)
+float RayJitter()
 {
-    // Find intersection with cube
-    viewRay = normalize(viewRay);
-    bool intersected = false;
-    vec3 intersectionPoint = vec3(-10000.0f, -10000.0f, -10000.0f);
-    float constant, query_1, query_2;
-
-    // int with x min
-    if(intersected == false)
-    {
-        if(viewRay.x != 0.0f)
-        {
-            constant = (cubeMin.x - currentPosition.x) / viewRay.x;
-
-            if(constant > 0.0f)
-            {
-                query_1 = currentPosition.y + (constant * viewRay.y);
-                query_2 = currentPosition.z + (constant * viewRay.z);
-
-                if((query_1 > cubeMin.y) && (query_1 < cubeMax.y) && (query_2 > cubeMin.z) && (query_2 < cubeMax.z)) 
-                {
-                    intersected = true;
-                    intersectionPoint = vec3(cubeMin.x, query_1, query_2);
-                }
-            }
-            
-        }
-        
-    }
-
-    // int with y min
-    if(intersected == false)
-    {
-        if(viewRay.y != 0.0f)
-        {
-            constant = (cubeMin.y - currentPosition.y) / viewRay.y;
-            
-            if(constant > 0.0f)
-            {
-                query_1 = currentPosition.x + (constant * viewRay.x);
-                query_2 = currentPosition.z + (constant * viewRay.z);
-
-                if((query_1 > cubeMin.x) && (query_1 < cubeMax.x) && (query_2 > cubeMin.z) && (query_2 < cubeMax.z)) 
-                {
-                    intersected = true;
-                    intersectionPoint = vec3(query_1, cubeMin.y, query_2);
-                }
-            }
-            
-        }
-        
-    }
+    // Ray start offset in [-0.5, 0.5) of a step, decorrelated between neighbouring pixels and frames
+    ivec3 size = textureSize(blueNoise, 0);
+    ivec3 texel = ivec3(ivec2(gl_FragCoord.xy) % size.xy, blueNoiseFrame % size.z);
+    return (fract(texelFetch(blueNoise, texel, 0).r + jitterRotation) - 0.5f) * jitterStrength;
+}
 
-    // int with z min
-    if(intersected == false)
+#include "ray_box.glsl"
+#include "density.glsl"
+#include "empty_space.glsl"
+const int ConeSamples = 6;
+const float ConeSpread = 0.25f; // Radius of the cone per unit of distance to the sample point
+const vec3 ConeKernel[ConeSamples] = vec3[](
+    vec3(0.38051305f, 0.92453449f, -0.02111345f), vec3(-0.50625799f, -0.03590792f, -0.86163418f),
+    vec3(-0.32509218f, -0.94557439f, 0.01428793f), vec3(0.09026238f, -0.27376545f, 0.95755165f),
+    vec3(0.28128598f, 0.42443639f, -0.86065785f), vec3(-0.16852403f, 0.14748697f, 0.97460106f));
+float ConeLightIntensity(vec3 samplePoint, vec3 lightRay, float lengthofIntersection, float viewFootprint, float jitter)
+{
+    // Steps double from the even march's step and spread over a widening cone, each sample reads the mip
+    // as wide as the cone there. One long sample stands for whatever is left up to the box exit, so the
+    // cost is the same however large the box is. Densities are weighted by the even samples they replace.
+    float step = 1.0f / n_lightSamples;
+    float max_maxDensity = (length(cubeMax - cubeMin) * n_lightSamples) - 1;
+    float opaqueDensity = OpaqueDensity(max_maxDensity / maxDensity);
+    float totalDensity = 0.0f;
+    float start = 0.0f;
+    for (int k = 0; k < ConeSamples && start < lengthofIntersection; k++)
     {
-        if(viewRay.z != 0.0f)
-        {
-            constant = (cubeMin.z - currentPosition.z) / viewRay.z;
-
-            if(constant > 0.0f)
-            {
-                query_1 = currentPosition.x + (constant * viewRay.x);
-                query_2 = currentPosition.y + (constant * viewRay.y);
-
-                if((query_1 > cubeMin.x) && (query_1 < cubeMax.x) && (query_2 > cubeMin.y) && (query_2 < cubeMax.y)) 
-                {
-                    intersected = true;
-                    intersectionPoint = vec3(query_1, query_2, cubeMin.z);
-                }
-            }
-            
-        }
-        
+        float segment = min(step * exp2(float(k)), lengthofIntersection - start);
+        float distance = start + (0.5f + jitter) * segment;
+        float radius = distance * ConeSpread;
+        vec3 lightSamplePoint = samplePoint + lightRay * distance + ConeKernel[k] * radius;
+        totalDensity += DensityAtSamplePoint(lightSamplePoint, max(max(segment, 2.0f * radius), viewFootprint)) * segment * n_lightSamples;
+        start += segment;
     }
-
-    // int with x max
-    if(intersected == false)
+    if (start < lengthofIntersection && totalDensity <= opaqueDensity)
     {
-        if(viewRay.x != 0.0f)
-        {
-            constant = (cubeMax.x - currentPosition.x) / viewRay.x;
-            
-            if(constant > 0.0f)
-            {
-                query_1 = currentPosition.y + (constant * viewRay.y);
-                query_2 = currentPosition.z + (constant * viewRay.z);
-
-                if((query_1 > cubeMin.y) && (query_1 < cubeMax.y) && (query_2 > cubeMin.z) && (query_2 < cubeMax.z)) 
-                {
-                    intersected = true;
-                    intersectionPoint = vec3(cubeMax.x, query_1, query_2);
-                }
-            }
-            
-        }
-        
+        float segment = lengthofIntersection - start;
+        vec3 lightSamplePoint = samplePoint + lightRay * (start + 0.5f * segment);
+        totalDensity += DensityAtSamplePoint(lightSamplePoint, max(segment, viewFootprint)) * segment * n_lightSamples;
     }
-
-    // int with y max
-    if(intersected == false)
-    {
-        if(viewRay.y != 0.0f)
-        {
-            constant = (cubeMax.y - currentPosition.y) / viewRay.y;
-            
-            if(constant > 0.0f)
-            {
-                query_1 = currentPosition.x + (constant * viewRay.x);
-                query_2 = currentPosition.z + (constant * viewRay.z);
-
-                if((query_1 > cubeMin.x) && (query_1 < cubeMax.x) && (query_2 > cubeMin.z) && (query_2 < cubeMax.z)) 
-                {
-                    intersected = true;
-                    intersectionPoint = vec3(query_1, cubeMax.y, query_2);
-                }
-            }
-            
-        }
-        
-    }
-
-    // int with z max
-    if(intersected == false)
-    {
-        if(viewRay.z != 0.0f)
-        {
-            constant = (cubeMax.z - currentPosition.z) / viewRay.z;
-
-            if(constant > 0.0f)
-            {
-                query_1 = currentPosition.x + (constant * viewRay.x);
-                query_2 = currentPosition.y + (constant * viewRay.y);
-
-                if((query_1 > cubeMin.x) && (query_1 < cubeMax.x) && (query_2 > cubeMin.y) && (query_2 < cubeMax.y)) 
-                {
-            
-                    intersected = true;
-                    intersectionPoint = vec3(query_1, query_2, cubeMax.z);
-                }
-            }
-           
-        }
-        
-    }
-
-    return intersectionPoint;
+    return exp(-1 * (totalDensity / max_maxDensity) * maxDensity);
 }
-float DensityAtSamplePoint(vec3 samplePoint)
-{
-    //float density = 0.0f;
-    vec4 texSample = texture(worleyTexture, (samplePoint + cloudOffset) * cloudScale);
-    
-    //if(texSample.a < 0.9) texSample.a = 0.0f;
-    //if(texSample.b < 0.8) texSample.b = 0.0f;
-    //if(texSample.g < 0.7) texSample.g = 0.0f;
-    //if(texSample.r < 0.6) texSample.r = 0.0f;
-    
-
-    //float density = ((texSample.r) + (texSample.g) + (texSample.b) + (texSample.a)) / 4;
-    float density = pow(texSample.r * texSample.g * texSample.b * texSample.a, 0.3f);
-
-    if (density < 0.75f) density = 0.0f;
-    //if (density > 0.95f) density = 1.0f;
-
-    return density;
-}
-float LightIntensityAtSamplePoint(vec3 samplePoint, vec3 viewRay)
+float LightIntensityAtSamplePoint(vec3 samplePoint, vec3 viewRay, float viewFootprint, float jitter)
 {
     vec3 lightRay = normalize(lightPosition - samplePoint);
-    vec3 intersectionPoint = IntersectionWithCube(samplePoint, lightRay);
     //float lightFactor = abs(dot(lightRay, viewRay));
 
-    if (length(intersectionPoint - samplePoint) > length(lightPosition - samplePoint))// Light is inside the cloud
-    {
-        intersectionPoint = lightPosition;
-    }
+    // Up to where the ray leaves the box, or up to the light when it is inside the cloud
+    float lengthofIntersection = min(RayBoxDistances(samplePoint, lightRay, cubeMin, cubeMax).y, length(lightPosition - samplePoint));
+    vec3 intersectionPoint = samplePoint + lightRay * lengthofIntersection;
 
     float totalDensity = 0.0f;
-    float lengthofIntersection = length(intersectionPoint - samplePoint);
     float numLightSamples = n_lightSamples * lengthofIntersection;
     float dx = lengthofIntersection / numLightSamples;
 
@@ -243,6 +144,7 @@ float LightIntensityAtSamplePoint(vec3 samplePoint, vec3 viewRay)
     {
         return 1.0f;
     }
+    if (lightMarchMode == 1) return ConeLightIntensity(samplePoint, lightRay, lengthofIntersection, viewFootprint, jitter);
     /*for (int i = 0; i <= int(numLightSamples); i++)
     {
         float offset = i / numLightSamples;
@@ -257,17 +159,63 @@ float LightIntensityAtSamplePoint(vec3 samplePoint, vec3 viewRay)
     //float atten = 1 / (lightDist + 0.1f);
 
     float max_maxDensity = (length(cubeMax - cubeMin) * n_lightSamples) - 1;
+    float opaqueDensity = OpaqueDensity(max_maxDensity / maxDensity); // Past this the light is blocked
+    float nextGridCheck = 0.0f; // Distance along the ray where the occupancy grid is read again
     for (int i = 1; i < int(numLightSamples); i++)
     {
-        float offset = i / numLightSamples;
+        float offset = (i + jitter) / numLightSamples;
         vec3 lightSamplePoint = ((1 - offset) * samplePoint) + ((offset) * intersectionPoint);
-        totalDensity += DensityAtSamplePoint(lightSamplePoint);
-
+        float distance = offset * lengthofIntersection;
+        if (distance >= nextGridCheck)
+        {
+            float run = EmptySpaceAhead(lightSamplePoint, lightRay, lengthofIntersection - distance);
+            if (run > 0.0f)
+            {
+                // Every sample in the run has zero density
+                i += int(ceil(run / dx)) - 1;
+                continue;
+            }
+            nextGridCheck = distance - run;
+        }
+        totalDensity += DensityAtSamplePoint(lightSamplePoint, max(dx, viewFootprint));
+        if (totalDensity > opaqueDensity) break;
     }
     float densityFactor = exp(-1 * (totalDensity / max_maxDensity) * maxDensity); // Normalized density  
     return densityFactor;
    
 }
+float LightVolumeTransmittance(vec3 samplePoint)
+{
+    // Clamped to the box's texel centres first so filtering never blends across the wrap
+    vec3 halfTexel = 0.5f / lightVolumeSize;
+    vec3 uvw = clamp((samplePoint - cubeMin) / (cubeMax - cubeMin) + lightVolumeResidual, halfTexel, 1.0f - halfTexel);
+    return texture(lightVolume, uvw + lightVolumeOrigin / lightVolumeSize).r;
+}
+vec2 SceneDistances(int level)
+{
+    // Range of the pyramid texel holding the pixel the view ray goes through. Texels of a level span 2^level
+    // pixels, the last one of an odd sized level a few more.
+    vec4 clip = cameraMatrix * vec4(currentPosition, 1.0f);
+    ivec2 pixel = ivec2((clip.xy / clip.w * 0.5f + 0.5f) * vec2(textureSize(depthPyramid, 0)));
+    ivec2 size = textureSize(depthPyramid, level);
+    return texelFetch(depthPyramid, clamp(pixel >> level, ivec2(0), size - 1), level).rg;
+}
+bool ClampToScene(inout vec2 span)
+{
+    // Ends the span at the farthest opaque surface under the ray's footprint, false when the scene hides
+    // all of it. The tile is read first: nearer than the entry it hides every ray of the tile, farther
+    // than the exit it hides none of them, and only in between is the ray's own texel read.
+    vec2 tile = SceneDistances(tileDepthLevel);
+    if (tile.y <= span.x) return false;
+    if (tile.x >= span.y) return true;
+    span.y = min(span.y, SceneDistances(rayDepthLevel).y);
+    return span.x < span.y;
+}
+float LightAtSamplePoint(vec3 samplePoint, vec3 viewRay, float footprint, float jitter)
+{
+    if (useLightVolume) return LightVolumeTransmittance(samplePoint);
+    return LightIntensityAtSamplePoint(samplePoint, viewRay, footprint, jitter);
+}
 vec4 VolumetricRenderCube()
 {
     // Find view ray
@@ -279,19 +227,25 @@ vec4 VolumetricRenderCube()
 
     vec3 viewRay = normalize(currentPosition - cameraPosition);
 
+    // Front faces march from where the view ray enters the box. With the camera inside the box there
+    // are only back faces, and those march from the camera.
+    vec2 span = RayBoxDistances(cameraPosition, viewRay, cubeMin, cubeMax);
+    bool cameraInside = span.x == 0.0f && span.y > 0.0f;
     float dotproduct = dot(normalize(fragmentNormal), viewRay);
-    if (dotproduct > 0.0f) return vec4(abs(fragmentNormal), 0.0f);
+    if ((dotproduct > 0.0f) != cameraInside) discard; // Would leave cloudDistance over the other face's
+    if (sceneDepthClamp && !ClampToScene(span)) discard;
     //else return vec4(vec3(0.0f, 0.0f, 0.0f), 0.0f);
 
-    vec3 intersectionPoint = IntersectionWithCube(currentPosition, viewRay);
+    vec3 entryPoint = cameraPosition + viewRay * span.x;
+    vec3 intersectionPoint = cameraPosition + viewRay * span.y;
 
 
-    if (intersectionPoint.x != -10000.0f)
+    if (span.x < span.y)
     {
         // Sample n points on the ray
-        float totalDensity = 0.0f; // To determine Opacity(alpha) of the point
         float totalLightIntensity = 0.0f; // To determine Colour of the point
-        float lengthofIntersection = length(intersectionPoint - currentPosition);
+        float totalDistance = 0.0f; // To determine where the point is, for reprojecting it
+        float lengthofIntersection = span.y - span.x;
         float numSamples = (n_samples * lengthofIntersection); // No. of parts the segment is divided into
         float dx = lengthofIntersection / (numSamples); // Length of each part
         // No. of sample points between the 2 intersection points on the line segment = numSamples - 1
@@ -328,29 +282,92 @@ vec4 VolumetricRenderCube()
         //float densityFactor = 1 - exp(-0.05 * (totalDensity * maxDensity)); // Normalized density
         //float lightFactor = totalLightIntensity / (lengthofIntersection); // Normalized intensity
         float max_maxDensity = (length(cubeMax - cubeMin) * n_samples) - 1; // Max Total points enclosed in segment
-        for (int i = 1; i < int(numSamples); i++)
+        float jitter = RayJitter();
+        float lightJitter = fract(jitter + 0.618034f) - 0.5f; // Golden ratio step, uncorrelated with the view ray's offset
+        float nextGridCheck = 0.0f; // Distance along the ray where the occupancy grid is read again
+        float stepFootprint = temporalAccumulation ? 0.0f : dx; // Averaged frames cover the step, a single one filters it
+
+        // Front to back: each sample absorbs 1 - exp(-density * extinction) of what is left, so the
+        // product of the samples is the old exp of the summed density, and the march can stop once
+        // the transmittance is gone
+        float extinction = maxDensity / max_maxDensity;
+        float transmittance = 1.0f;
+        // Sample i is jittered inside step i, and the steps cover the whole segment, so frames with
+        // different jitter average out to the integral
+        int lastSample = int(ceil(numSamples)) - 1;
+        int stride = 1;    // Samples advanced per step, airStride while in air
+        int emptyRun = 0;  // Consecutive samples without density
+        int i = 0;
+        while (i <= lastSample && transmittance > transmittanceEpsilon)
         {
-            float offset = i / numSamples;
-            vec3 samplePoint = (1 - offset) * currentPosition + (offset)*intersectionPoint;
+            float offset = (i + 0.5f + jitter) / numSamples;
+            if (offset >= 1.0f) break; // Past the end of a partial last step
+            vec3 samplePoint = (1 - offset) * entryPoint + (offset)*intersectionPoint;
+            float distance = offset * lengthofIntersection;
 
-            float sampleDensity = DensityAtSamplePoint(samplePoint);
-            totalDensity += sampleDensity;
-            totalLightIntensity += LightIntensityAtSamplePoint(samplePoint, viewRay);
+            if (distance >= nextGridCheck)
+            {
+                float run = EmptySpaceAhead(samplePoint, viewRay, lengthofIntersection - distance);
+                if (run > 0.0f)
+                {
+                    // Every sample in the run has zero density and adds nothing
+                    i += int(ceil(run / dx));
+                    continue;
+                }
+                nextGridCheck = distance - run;
+            }
 
+            float footprint = max(stepFootprint, length(samplePoint - cameraPosition) * pixelSpread);
 
+            float sampleDensity = DensityAtSamplePoint(samplePoint, footprint);
+            if (sampleDensity > 0.0f)
+            {
+                if (stride > 1)
+                {
+                    // A long stride landed in the cloud, go back over the samples it stepped past
+                    i -= stride - 1;
+                    stride = 1;
+                    emptyRun = 0;
+                    continue;
+                }
+                float sampleAlpha = 1.0f - exp(-sampleDensity * extinction);
+                totalLightIntensity += transmittance * sampleAlpha * LightAtSamplePoint(samplePoint, viewRay, footprint, lightJitter * jitterStrength);
+                totalDistance += transmittance * sampleAlpha * (span.x + distance);
+                transmittance *= 1.0f - sampleAlpha;
+                emptyRun = 0;
+            }
+            else if (++emptyRun >= airStride) stride = airStride;
+            i += stride;
         }
-        //float densityFactor = (totalDensity / max_maxDensity) * maxDensity;
-        float densityFactor = 1 - exp(-1 * (totalDensity / max_maxDensity) * maxDensity); // Normalized density
-        float lightFactor = totalLightIntensity / (numSamples - 1); // Normalized intensity
+        float densityFactor = 1.0f - transmittance; // Opacity(alpha) of the ray
+        float lightFactor = densityFactor > 0.0f ? totalLightIntensity / densityFactor : 0.0f; // Light of the samples, weighted by what each one adds
+        cloudDistance = vec4(densityFactor > 0.0f ? totalDistance / densityFactor : span.x, 0.0f, 0.0f, 1.0f);
 
         return vec4(lightFactor * vec3(lightColor) * surfaceColour, densityFactor);
     }
-    return vec4(abs(fragmentNormal), 1.0f);
+    return vec4(surfaceColour, 0.0f); // Grazes an edge of the box, the slab test misses what the raster hit
     
     
 }
 
+#ifdef LIGHT_VOLUME_PASS
+uniform int lightVolumeSlice;
+
+void main()
+{
+    // Transmittance from the centre of this texel to the light, one slice of the light volume per draw.
+    // Storage wraps around, the texel at lightVolumeOrigin is the one at cubeMin.
+    ivec3 size = ivec3(lightVolumeSize);
+    ivec3 texel = (ivec3(ivec2(gl_FragCoord.xy), lightVolumeSlice) - ivec3(lightVolumeOrigin) + size) % size;
+    vec3 uvw = (vec3(texel) + 0.5f) / lightVolumeSize;
+    vec3 texelSize = (cubeMax - cubeMin) / lightVolumeSize;
+    float footprint = max(texelSize.x, max(texelSize.y, texelSize.z));
+    color = vec4(LightIntensityAtSamplePoint(mix(cubeMin, cubeMax, uvw), vec3(0.0f), footprint, 0.0f), 0.0f, 0.0f, 1.0f);
+}
+#else
 void main()
 {
+    cloudDistance = vec4(0.0f, 0.0f, 0.0f, 1.0f);
     color = VolumetricRenderCube();
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
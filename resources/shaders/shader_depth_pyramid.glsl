@@ -0,0 +1,57 @@
+#shader vertex
+#version 330 core
+
+void main()
+{
+    // One triangle over the whole level, drawn without vertex buffers
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(corner * 2.0f - 1.0f, 0.0f, 1.0f);
+}
+
+
+#shader fragment
+#version 330 core
+
+out vec2 range;
+
+uniform sampler2D sceneDepth;   // Scene depth at the viewport's resolution, read for level 0
+uniform sampler2D depthPyramid; // Level above the one being written, bound as the texture's base level
+uniform int level;
+uniform mat4 inverseCameraMatrix;
+uniform vec3 cameraPosition;
+
+const float NoGeometry = 1e30f; // Distance of pixels nothing opaque was drawn in
+
+void main()
+{
+    // Nearest and farthest distance from the camera to the opaque scene over each texel's pixels. Level 0
+    // is one pixel per texel, every other level takes the texels of the one above it under its own, three
+    // along an axis where that level has an odd size so the last row and column are not dropped.
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    if (level == 0)
+    {
+        vec2 size = vec2(textureSize(sceneDepth, 0));
+        float depth = texelFetch(sceneDepth, texel, 0).r;
+        if (depth >= 1.0f)
+        {
+            range = vec2(NoGeometry);
+            return;
+        }
+        vec4 position = inverseCameraMatrix * vec4(vec3((vec2(texel) + 0.5f) / size, depth) * 2.0f - 1.0f, 1.0f);
+        range = vec2(length(position.xyz / position.w - cameraPosition));
+        return;
+    }
+
+    ivec2 size = textureSize(depthPyramid, 0);
+    ivec2 first = texel * 2;
+    ivec2 last = min(first + 1 + ivec2(equal(first + 2, size - 1)), size - 1);
+    range = vec2(NoGeometry, 0.0f);
+    for (int y = first.y; y <= last.y; y++)
+    {
+        for (int x = first.x; x <= last.x; x++)
+        {
+            vec2 finer = texelFetch(depthPyramid, ivec2(x, y), 0).rg;
+            range = vec2(min(range.x, finer.x), max(range.y, finer.y));
+        }
+    }
+}
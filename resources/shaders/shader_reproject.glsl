@@ -0,0 +1,151 @@
+#shader vertex
+#version 330 core
+
+out vec2 screenUV;
+
+void main()
+{
+    // One triangle over the whole target, drawn without vertex buffers
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    screenUV = corner;
+    gl_Position = vec4(corner * 2.0f - 1.0f, 0.0f, 1.0f);
+}
+
+
+#shader fragment
+#version 330 core
+
+in vec2 screenUV;
+
+out vec4 color;
+
+uniform sampler2D cloudColor;     // This frame's cloud, one texel per ray
+uniform sampler2D cloudDistance;  // Distance from the camera to the cloud along each marched ray, 0 where there is none
+uniform sampler2D history;        // Cloud accumulated over the previous frames at the viewport's resolution
+uniform bool historyValid;
+uniform mat4 inverseCameraMatrix;
+uniform mat4 previousCameraMatrix;
+uniform vec3 cameraPosition;
+uniform vec3 cloudMotion;         // Change of cloudOffset since the previous frame
+uniform float zFar;
+#ifdef INTERLEAVE_PASS
+uniform int interleave;           // One ray in interleave x interleave was marched this frame
+uniform ivec2 phase;              // Which one, within each block
+#else
+uniform sampler2D upsampledColor; // This frame's cloud upsampled to the viewport, premultiplied
+#endif
+
+const float CurrentWeight = 0.1f; // Share of this frame in the accumulated cloud while still
+const float MotionWeight = 1.0f;  // Added share per ray spacing the cloud moved since the previous frame
+
+vec4 SampleHistory(vec2 uv)
+{
+    // Catmull-Rom through 9 bilinear taps, bilinear alone blurs the history a little more every frame
+    vec2 size = vec2(textureSize(history, 0));
+    vec2 position = uv * size - 0.5f;
+    vec2 base = floor(position);
+    vec2 f = position - base;
+    vec2 w0 = f * (-0.5f + f * (1.0f - 0.5f * f));
+    vec2 w1 = 1.0f + f * f * (-2.5f + 1.5f * f);
+    vec2 w2 = f * (0.5f + f * (2.0f - 1.5f * f));
+    vec2 w3 = f * f * (-0.5f + 0.5f * f);
+    vec2 w12 = w1 + w2;
+    vec2 uv0 = (base - 0.5f) / size;
+    vec2 uv12 = (base + 0.5f + w2 / w12) / size;
+    vec2 uv3 = (base + 2.5f) / size;
+
+    vec4 total = vec4(0.0f);
+    total += (texture(history, vec2(uv0.x, uv0.y)) * w0.x + texture(history, vec2(uv12.x, uv0.y)) * w12.x + texture(history, vec2(uv3.x, uv0.y)) * w3.x) * w0.y;
+    total += (texture(history, vec2(uv0.x, uv12.y)) * w0.x + texture(history, vec2(uv12.x, uv12.y)) * w12.x + texture(history, vec2(uv3.x, uv12.y)) * w3.x) * w12.y;
+    total += (texture(history, vec2(uv0.x, uv3.y)) * w0.x + texture(history, vec2(uv12.x, uv3.y)) * w12.x + texture(history, vec2(uv3.x, uv3.y)) * w3.x) * w3.y;
+    return max(total, vec4(0.0f));
+}
+bool Reproject(vec2 uv, float distance, out vec2 previousUV)
+{
+    // Where the cloud seen through uv was last frame, false if that was off screen. Density at p used to
+    // be at p + cloudMotion.
+    vec4 farPoint = inverseCameraMatrix * vec4(uv * 2.0f - 1.0f, 1.0f, 1.0f);
+    vec3 viewRay = normalize(farPoint.xyz / farPoint.w - cameraPosition);
+    vec3 position = cameraPosition + viewRay * (distance > 0.0f ? distance : zFar);
+    vec4 previous = previousCameraMatrix * vec4(position + (distance > 0.0f ? cloudMotion : vec3(0.0f)), 1.0f);
+    previousUV = previous.xy / previous.w * 0.5f + 0.5f;
+    return previous.w > 0.0f && all(greaterThanEqual(previousUV, vec2(0.0f))) && all(lessThanEqual(previousUV, vec2(1.0f)));
+}
+#ifdef INTERLEAVE_PASS
+void main()
+{
+    // One texel per ray of a full march. Rays marched this frame are copied, the rest come from the history,
+    // clamped to the marched rays around them.
+    ivec2 ray = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(cloudColor, 0);
+    vec2 position = vec2(ray - phase) / float(interleave); // Marched ray j is at position j
+    ivec2 base = ivec2(floor(position));
+    vec2 f = position - vec2(base);
+    if (all(equal(ray - phase, base * interleave)))
+    {
+        color = texelFetch(cloudColor, min(base, size - 1), 0);
+        return;
+    }
+
+    vec4 current = vec4(0.0f);
+    vec4 lo = vec4(1e9f);
+    vec4 hi = vec4(-1e9f);
+    for (int i = 0; i < 4; i++)
+    {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        vec4 neighbour = texelFetch(cloudColor, clamp(base + offset, ivec2(0), size - 1), 0);
+        current += neighbour * (offset.x == 1 ? f.x : 1.0f - f.x) * (offset.y == 1 ? f.y : 1.0f - f.y);
+        lo = min(lo, neighbour);
+        hi = max(hi, neighbour);
+    }
+
+    vec2 previousUV;
+    float distance = texelFetch(cloudDistance, clamp(ivec2(floor(position + 0.5f)), ivec2(0), size - 1), 0).r;
+    if (!historyValid || !Reproject(screenUV, distance, previousUV))
+    {
+        color = current;
+        return;
+    }
+
+    // Interpolated neighbours take over as the history goes stale, as in the accumulation below
+    float motion = length((previousUV - screenUV) * vec2(size * interleave));
+    color = mix(clamp(SampleHistory(previousUV), lo, hi), current, min(motion * MotionWeight, 1.0f));
+}
+#else
+void main()
+{
+    ivec2 size = textureSize(cloudColor, 0);
+    ivec2 rays = textureSize(cloudDistance, 0);
+    vec4 current = texelFetch(upsampledColor, ivec2(gl_FragCoord.xy), 0);
+
+    // Range of the upsampled cloud one ray around, history outside it is from something that moved or
+    // changed. Taken from the upsampled colour the range varies smoothly between rays instead of in blocks.
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    ivec2 fullSize = textureSize(upsampledColor, 0);
+    ivec2 stride = fullSize / size;
+    vec4 lo = current;
+    vec4 hi = current;
+    for (int y = -1; y <= 1; y++)
+    {
+        for (int x = -1; x <= 1; x++)
+        {
+            vec4 neighbour = texelFetch(upsampledColor, clamp(pixel + ivec2(x, y) * stride, ivec2(0), fullSize - 1), 0);
+            lo = min(lo, neighbour);
+            hi = max(hi, neighbour);
+        }
+    }
+
+    vec2 previousUV;
+    float distance = texelFetch(cloudDistance, min(ivec2(screenUV * vec2(rays)), rays - 1), 0).r;
+    if (!historyValid || !Reproject(screenUV, distance, previousUV))
+    {
+        color = current;
+        return;
+    }
+
+    // Texel sized detail changes as the cloud moves across the rays, faster than the clamp catches, so the
+    // history is trusted less the further it was reprojected
+    float motion = length((previousUV - screenUV) * vec2(size));
+    color = mix(clamp(SampleHistory(previousUV), lo, hi), current, min(CurrentWeight + motion * MotionWeight, 1.0f));
+}
+#endif
@@ -0,0 +1,62 @@
+#shader vertex
+#version 330 core
+
+out vec2 screenUV;
+
+void main()
+{
+    // One triangle over the whole viewport, drawn without vertex buffers
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    screenUV = corner;
+    gl_Position = vec4(corner * 2.0f - 1.0f, 0.0f, 1.0f);
+}
+
+
+#shader fragment
+#version 330 core
+
+in vec2 screenUV;
+
+out vec4 color;
+
+uniform sampler2D cloudColor; // Premultiplied cloud, one texel per ray
+uniform sampler2D sceneDepth; // Scene depth at the viewport's resolution
+uniform vec2 cloudGridSize;   // Cloud texels across the viewport
+uniform vec2 cloudGridOrigin; // Where the first cloud texel's ray crosses the viewport, in cloud texels
+uniform float zNear;
+uniform float zFar;
+
+const float DepthTolerance = 0.01f; // Relative depth difference that halves a texel's weight
+
+float LinearDepth(float depth)
+{
+    return zNear * zFar / (zFar - depth * (zFar - zNear));
+}
+void main()
+{
+    // Joint bilateral upsample: the four cloud texels around the pixel are weighted bilinearly and by how
+    // close the scene depth they were rendered against is to this pixel's, so cloud does not bleed over
+    // the edges of the ground or the light. Premultiplied colours weight each texel's colour by its alpha.
+    vec2 size = vec2(textureSize(cloudColor, 0));
+    vec2 position = screenUV * cloudGridSize - cloudGridOrigin;
+    vec2 base = floor(position);
+    vec2 f = position - base;
+    vec2 sceneSize = vec2(textureSize(sceneDepth, 0));
+    float depth = LinearDepth(texelFetch(sceneDepth, ivec2(screenUV * sceneSize), 0).r);
+
+    vec4 total = vec4(0.0f);
+    float totalWeight = 0.0f;
+    for (int i = 0; i < 4; i++)
+    {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 texel = clamp(ivec2(base) + offset, ivec2(0), ivec2(size) - 1);
+        float bilinear = (offset.x == 1 ? f.x : 1.0f - f.x) * (offset.y == 1 ? f.y : 1.0f - f.y);
+        // Scene depth under the texel's ray, the point the cloud was depth tested against
+        ivec2 rayPixel = clamp(ivec2((vec2(texel) + cloudGridOrigin) / cloudGridSize * sceneSize), ivec2(0), ivec2(sceneSize) - 1);
+        float difference = abs(LinearDepth(texelFetch(sceneDepth, rayPixel, 0).r) - depth) / depth;
+        float weight = (bilinear + 1e-3f) * DepthTolerance / (DepthTolerance + difference);
+        total += texelFetch(cloudColor, texel, 0) * weight;
+        totalWeight += weight;
+    }
+    color = total / totalWeight;
+}
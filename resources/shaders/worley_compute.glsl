@@ -0,0 +1,131 @@
+#shader compute
+#version 430 core
+
+// Worley noise written straight into the noise texture. Feature points are built on the GPU
+// from the same counter based hash as the CPU FeaturePointGrid, so both paths give the same volume.
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 8) in;
+
+layout(std430, binding = 0) buffer ChannelRange
+{
+    float maxDistance[4]; // Largest squared distance of each channel, bounded on the host from the feature points
+};
+layout(std430, binding = 1) buffer FeaturePoints
+{
+    vec4 points[]; // Padded feature point grid of each channel, see FeaturePointGrid
+};
+
+uniform writeonly image3D noiseImage;
+uniform int resolution;
+uniform int channels;
+uniform ivec4 frequency;
+uniform int seed;
+uniform int pass; // 0 builds the feature points, 1 remaps and stores
+uniform int firstSlice; // Pass 1 runs a slab of z slices per dispatch, starting here
+
+uint Hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+float Random(uint channelSeed, int x, int y, int z, uint counter)
+{
+    uint h = Hash(counter + channelSeed);
+    h = Hash(h ^ uint(x));
+    h = Hash(h ^ uint(y));
+    h = Hash(h ^ uint(z));
+    return float(h >> 8) * (1.0f / 16777216.0f);
+}
+int WorleyCellIndex(float voxelPos, int numCells)
+{
+    return int(float(int(voxelPos * float(numCells))) / 100.0f);
+}
+vec3 FeaturePoint(ivec3 cell, int numCells, uint channelSeed)
+{
+    // Point of cell -1 ... numCells, border cells are copies of the opposite side shifted by the period
+    ivec3 wrapped = (cell + numCells) % numCells;
+    float cellSize = 100.0f / float(numCells);
+
+    vec3 pos;
+    if (Random(channelSeed, wrapped.x, wrapped.y, wrapped.z, 0U) > 0.6f)
+    {
+        pos = vec3(1000.0f);
+    }
+    else
+    {
+        vec3 randomOffset = vec3(Random(channelSeed, wrapped.x, wrapped.y, wrapped.z, 1U),
+            Random(channelSeed, wrapped.x, wrapped.y, wrapped.z, 2U),
+            Random(channelSeed, wrapped.x, wrapped.y, wrapped.z, 3U));
+        pos = (vec3(wrapped) + randomOffset) * cellSize;
+    }
+    pos -= vec3(lessThan(cell, ivec3(0))) * 100.0f;
+    pos += vec3(equal(cell, ivec3(numCells))) * 100.0f;
+    return pos;
+}
+int PointOffset(int channel)
+{
+    // Channels are stored one after another, each as a padded (cells + 2)^3 grid
+    int offset = 0;
+    for (int c = 0; c < channel; c++) offset += (frequency[c] + 2) * (frequency[c] + 2) * (frequency[c] + 2);
+    return offset;
+}
+int PointIndex(ivec3 cell, int numCells)
+{
+    // Cell indices run from -1 to numCells inclusive
+    int padded = numCells + 2;
+    return (cell.x + 1) + padded * ((cell.y + 1) + padded * (cell.z + 1));
+}
+
+void main()
+{
+    ivec3 id = ivec3(gl_GlobalInvocationID);
+
+    if (pass == 0)
+    {
+        // One invocation per padded cell, the FeaturePointGrid of every channel
+        for (int channel = 0; channel < channels; channel++)
+        {
+            int numCells = frequency[channel];
+            if (any(greaterThanEqual(id, ivec3(numCells + 2)))) continue;
+            ivec3 cell = id - 1;
+            points[PointOffset(channel) + PointIndex(cell, numCells)] = vec4(FeaturePoint(cell, numCells, Hash(uint(seed) + uint(channel))), 0.0f);
+        }
+        return;
+    }
+
+    id.z += firstSlice;
+    if (any(greaterThanEqual(id, ivec3(resolution)))) return;
+    vec3 voxelPos = 100.0f * ((vec3(id) + 0.5f) / float(resolution));
+
+    vec4 value = vec4(0.0f);
+    for (int channel = 0; channel < channels; channel++)
+    {
+        // Squared distance to the nearest feature point in the 27 surrounding cells
+        int numCells = frequency[channel];
+        int offset = PointOffset(channel);
+        ivec3 cellIndex = ivec3(WorleyCellIndex(voxelPos.x, numCells), WorleyCellIndex(voxelPos.y, numCells), WorleyCellIndex(voxelPos.z, numCells));
+
+        float dist = 1000.0f;
+        for (int kk = -1; kk <= 1; kk++)
+        {
+            for (int jj = -1; jj <= 1; jj++)
+            {
+                for (int ii = -1; ii <= 1; ii++)
+                {
+                    vec3 d = voxelPos - points[offset + PointIndex(cellIndex + ivec3(ii, jj, kk), numCells)].xyz;
+                    float pointDist = d.x * d.x + d.y * d.y + d.z * d.z;
+                    if (pointDist < dist) dist = pointDist;
+                }
+            }
+        }
+
+        // 1 - dist / maxDist, near feature points is dense
+        float scale = -1.0f / max(maxDistance[channel], 1e-6f);
+        value[channel] = clamp(dist * scale + 1.0f, 0.0f, 1.0f);
+    }
+    imageStore(noiseImage, id, value);
+}
@@ -1,7 +1,19 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include "glad/glad.h"
 #include "GLFW/glfw3.h"
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/packing.hpp"
 #include <iostream>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -12,8 +24,34 @@
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
 #include <ft2build.h>
 #include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <limits>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+// The AVX2 kernel is compiled next to the SSE2 one and picked at runtime, so the build runs on any x86-64
+#include <immintrin.h>
+#define WORLEY_SIMD_SSE
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define WORLEY_SIMD_AVX2
+#define WORLEY_TARGET_AVX2
+#elif defined(__GNUC__) || defined(__clang__)
+#define WORLEY_SIMD_AVX2
+#define WORLEY_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
 #include FT_FREETYPE_H  
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_glfw.h" 
@@ -32,597 +70,3512 @@ void GLDetectError(const char* file, int line)
 
 }
 #define GLCall(x) GLClearError();x;GLDetectError(__FILE__, __LINE__);
+
+// GL 4.3 compute entry points. glad was generated for the 3.3 core profile, so these
+// are looked up at runtime and stay null when the context is older.
+#define GL_COMPUTE_SHADER 0x91B9
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#define GL_TEXTURE_UPDATE_BARRIER_BIT 0x00000100
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC)(GLuint numGroupsX, GLuint numGroupsY, GLuint numGroupsZ);
+typedef void (APIENTRYP PFNGLBINDIMAGETEXTUREPROC)(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+typedef void (APIENTRYP PFNGLMEMORYBARRIERPROC)(GLbitfield barriers);
+PFNGLDISPATCHCOMPUTEPROC glDispatchCompute = nullptr;
+PFNGLBINDIMAGETEXTUREPROC glBindImageTexture = nullptr;
+PFNGLMEMORYBARRIERPROC glMemoryBarrier = nullptr;
+
+bool LoadComputeFunctions(GLADloadproc load)
+{
+    // True when the context is 4.3 or newer and every entry point was found
+    if (GLVersion.major * 10 + GLVersion.minor < 43) return false;
+    glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)load("glDispatchCompute");
+    glBindImageTexture = (PFNGLBINDIMAGETEXTUREPROC)load("glBindImageTexture");
+    glMemoryBarrier = (PFNGLMEMORYBARRIERPROC)load("glMemoryBarrier");
+    return glDispatchCompute && glBindImageTexture && glMemoryBarrier;
+}
+
+// GL 4.4 immutable buffer storage, lets a pixel unpack buffer stay mapped while it is in use
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+PFNGLBUFFERSTORAGEPROC glBufferStorage = nullptr;
+
+bool LoadBufferStorage(GLADloadproc load)
+{
+    if (GLVersion.major * 10 + GLVersion.minor < 44) return false;
+    glBufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+    return glBufferStorage != nullptr;
+}
 float PI = std::atan(45) * 4;
 
-float Random()
+unsigned int Hash(unsigned int x)
+{
+    // Integer avalanche hash (lowbias32), used as a counter-based RNG
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+float Random(unsigned int seed, int x, int y, int z, unsigned int counter)
 {
-    return (static_cast<float>(std::rand()) / RAND_MAX);
+    // Stateless random number in [0, 1) for a given cell and draw index.
+    // Same inputs always give the same value, whatever thread asks for it.
+    unsigned int h = Hash(counter + seed);
+    h = Hash(h ^ (unsigned int)x);
+    h = Hash(h ^ (unsigned int)y);
+    h = Hash(h ^ (unsigned int)z);
+    return (float)(h >> 8) * (1.0f / 16777216.0f);
 }
 
-class VertexBuffer
+class ThreadPool
 {
 private:
-    unsigned int ID;
-public:
-    VertexBuffer(const void* data, unsigned int size)
+    typedef struct
     {
-        // Initialize Vextex Buffer
-        GLCall(glGenBuffers(1, &ID));
-        GLCall(glBindBuffer(GL_ARRAY_BUFFER, ID));
-        GLCall(glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW));
+        std::function<void(int)> task;
+        int count;
+        std::atomic<int> next;
+        std::atomic<int> finished;
+    }Batch;
+
+    std::vector<std::thread> workers;
+    std::deque<std::shared_ptr<Batch>> batches;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool stopping;
+
+    void RunBatch(Batch* batch)
+    {
+        // Grab indices until the batch runs dry
+        int index;
+        while ((index = batch->next++) < batch->count)
+        {
+            batch->task(index);
+            if (++batch->finished == batch->count)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.notify_all();
+            }
+        }
     }
-    ~VertexBuffer()
+    void WorkerLoop()
     {
-        // Delete VBO
-        GLCall(glDeleteBuffers(1, &ID));
+        while (true)
+        {
+            std::shared_ptr<Batch> batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !batches.empty(); });
+                if (stopping) return;
+
+                batch = batches.front();
+                if (batch->next >= batch->count) // Every index handed out already
+                {
+                    batches.pop_front();
+                    continue;
+                }
+            }
+            RunBatch(batch.get());
+        }
     }
-    void Bind()
+public:
+    ThreadPool(unsigned int numThreads = 0)
     {
-        // Bind/Use VBO
-        GLCall(glBindBuffer(GL_ARRAY_BUFFER, ID));
+        // The calling thread also works on its own batches, so spawn one less
+        if (numThreads == 0) numThreads = std::thread::hardware_concurrency();
+        stopping = false;
+        for (unsigned int i = 1; i < numThreads; i++)
+        {
+            workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+        }
     }
-    void Unbind()
+    ~ThreadPool()
     {
-        // Unbind VBO
-        GLCall(glBindBuffer(GL_ARRAY_BUFFER, 0));
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) workers[i].join();
     }
-    void SubData(float* data, unsigned int size)
+    void ParallelFor(int count, const std::function<void(int)>& task)
     {
-        // Substitute VBO data
-        Bind();
-        GLCall(glBufferSubData(GL_ARRAY_BUFFER, 0, size, (const void*)data));
-        Unbind();
+        // Run task(0) ... task(count - 1) across the pool and wait for all of them.
+        // Safe to call from several threads at once, batches are served in order.
+        if (count <= 0) return;
+
+        std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+        batch->task = task;
+        batch->count = count;
+        batch->next = 0;
+        batch->finished = 0;
+
+        if (!workers.empty())
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batches.push_back(batch);
+            wake.notify_all();
+        }
+
+        RunBatch(batch.get());
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&batch] { return batch->finished == batch->count; });
     }
-    unsigned int GetID()
+    unsigned int GetThreadCount()
     {
-        return ID;
+        return (unsigned int)workers.size() + 1;
     }
 };
-class IndexBuffer
+void ParallelFor(ThreadPool* pool, int count, const std::function<void(int)>& task)
+{
+    // Serial fallback when no pool is available
+    if (pool) pool->ParallelFor(count, task);
+    else for (int i = 0; i < count; i++) task(i);
+}
+
+typedef struct
+{
+    int generator;       // Index into NoiseGeneratorNames
+    int resolution;      // Voxels along each side of the noise volume
+    int channels;        // Channels stored, 1 to 4
+    int frequency[4];    // Base lattice cells along each side, one per channel
+    int octaves;         // Octaves summed by the fbm based generators
+    unsigned int seed;
+}NoiseSettings;
+
+const char* NoiseGeneratorNames[] = { "Worley", "Perlin-Worley", "Curl", "Value" };
+const int NumNoiseGenerators = 4;
+
+size_t NoiseVolumeBytes(const NoiseSettings& settings)
+{
+    return (size_t)settings.resolution * settings.resolution * settings.resolution * settings.channels;
+}
+
+class FeaturePointGrid
 {
+    // Worley feature points of a tileable volume in one flat structure-of-arrays buffer.
+    // The grid carries a border of one cell on every side holding copies of the opposite
+    // side shifted by the period, so the 27 cell search never has to wrap.
 private:
-    unsigned int ID;
-    unsigned int Count;
+    int numCells;
+    int paddedCells;
+    std::vector<float> pointX, pointY, pointZ;
 public:
-    IndexBuffer(const unsigned int* data, unsigned int count)
+    FeaturePointGrid(int nCells, unsigned int seed)
     {
-        // No. of indices to draw
-        Count = count;
+        numCells = nCells;
+        paddedCells = nCells + 2;
+        int count = paddedCells * paddedCells * paddedCells;
+        pointX.resize(count);
+        pointY.resize(count);
+        pointZ.resize(count);
 
-        // Initialize IBO
-        GLCall(glGenBuffers(1, &ID));
-        GLCall(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ID));
-        GLCall(glBufferData(GL_ELEMENT_ARRAY_BUFFER, Count * sizeof(unsigned int), data, GL_STATIC_DRAW));
+        float cellSize = 100.0f / numCells;
+
+        for (int k = -1; k <= numCells; k++)
+        {
+            for (int j = -1; j <= numCells; j++)
+            {
+                for (int i = -1; i <= numCells; i++)
+                {
+                    // Wrap to the cell that owns the point, then shift by the period
+                    int wrapI = (i + numCells) % numCells;
+                    int wrapJ = (j + numCells) % numCells;
+                    int wrapK = (k + numCells) % numCells;
+
+                    glm::vec3 pos;
+                    if (Random(seed, wrapI, wrapJ, wrapK, 0) > 0.6f)
+                    {
+                        pos = glm::vec3(1000.0f, 1000.0f, 1000.0f);
+                    }
+                    else
+                    {
+                        glm::vec3 randomOffset = glm::vec3(Random(seed, wrapI, wrapJ, wrapK, 1), Random(seed, wrapI, wrapJ, wrapK, 2), Random(seed, wrapI, wrapJ, wrapK, 3));
+                        pos = (glm::vec3(wrapI, wrapJ, wrapK) + randomOffset) * cellSize;
+                    }
+
+                    if (i < 0) pos.x -= 100.0f;
+                    if (j < 0) pos.y -= 100.0f;
+                    if (k < 0) pos.z -= 100.0f;
+                    if (i == numCells) pos.x += 100.0f;
+                    if (j == numCells) pos.y += 100.0f;
+                    if (k == numCells) pos.z += 100.0f;
+
+                    int index = Index(i, j, k);
+                    pointX[index] = pos.x;
+                    pointY[index] = pos.y;
+                    pointZ[index] = pos.z;
+                }
+            }
+        }
     }
-    ~IndexBuffer()
+    int Index(int i, int j, int k) const
     {
-        // Delete IBO
-        GLCall(glDeleteBuffers(1, &ID));
+        // Cell indices run from -1 to numCells inclusive
+        return (i + 1) + paddedCells * ((j + 1) + paddedCells * (k + 1));
     }
-    void Bind()
+    int GetNumCells() const
     {
-        // Bind/Use IBO
-        GLCall(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ID));
+        return numCells;
     }
-    void Unbind()
+    const float* GetX() const { return pointX.data(); }
+    const float* GetY() const { return pointY.data(); }
+    const float* GetZ() const { return pointZ.data(); }
+};
+
+int WorleyCellIndex(float voxelPos, int numCells)
+{
+    return (int)((int)(voxelPos * numCells) / 100.0f);
+}
+float WorleyMinDistance(const FeaturePointGrid& grid, glm::vec3 voxelPos)
+{
+    // Squared distance to the nearest feature point in the 27 surrounding cells
+    int numCells = grid.GetNumCells();
+    int cellIndexX = WorleyCellIndex(voxelPos.x, numCells);
+    int cellIndexY = WorleyCellIndex(voxelPos.y, numCells);
+    int cellIndexZ = WorleyCellIndex(voxelPos.z, numCells);
+
+    const float* pointX = grid.GetX();
+    const float* pointY = grid.GetY();
+    const float* pointZ = grid.GetZ();
+
+    float minDist = 1000.0f;
+    for (int kk = -1; kk <= 1; kk++)
     {
-        // Unbind IBO
-        GLCall(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+        for (int jj = -1; jj <= 1; jj++)
+        {
+            int row = grid.Index(cellIndexX, cellIndexY + jj, cellIndexZ + kk);
+            for (int ii = -1; ii <= 1; ii++)
+            {
+                float dx = voxelPos.x - pointX[row + ii];
+                float dy = voxelPos.y - pointY[row + ii];
+                float dz = voxelPos.z - pointZ[row + ii];
+                float dist = dx * dx + dy * dy + dz * dz;
+                if (dist < minDist) minDist = dist;
+            }
+        }
     }
-    unsigned int GetID()
+    return minDist;
+}
+bool CpuHasAvx2()
+{
+    // The instructions alone are not enough, the OS also has to save the ymm registers
+#if defined(WORLEY_SIMD_AVX2) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osSavesYmm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5));
+#elif defined(WORLEY_SIMD_AVX2)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+const bool WorleyAvx2 = CpuHasAvx2();
+
+const char* WorleySimdName()
+{
+#if defined(WORLEY_SIMD_SSE)
+    return WorleyAvx2 ? "AVX2" : "SSE2";
+#else
+    return "none";
+#endif
+}
+#if defined(WORLEY_SIMD_SSE)
+// Eight voxels of a row at once: every lane shares the y and z cells, so the candidate points are
+// broadcast and lanes only mask out cells outside their own 3x3x3
+void WorleyBlockSSE(const FeaturePointGrid& grid, const float* posX, const float* cellX, float posY, float posZ, int cellIndexY, int cellIndexZ, float* result)
+{
+    const float* pointX = grid.GetX();
+    const float* pointY = grid.GetY();
+    const float* pointZ = grid.GetZ();
+    int firstCell = (int)cellX[0] - 1;
+    int lastCell = (int)cellX[7] + 1;
+
+    __m128 vPosX[2] = { _mm_loadu_ps(posX), _mm_loadu_ps(posX + 4) };
+    __m128 vCellX[2] = { _mm_loadu_ps(cellX), _mm_loadu_ps(cellX + 4) };
+    __m128 vMin[2] = { _mm_set1_ps(1000.0f), _mm_set1_ps(1000.0f) };
+    __m128 vOne = _mm_set1_ps(1.0f);
+    __m128 vFar = _mm_set1_ps(std::numeric_limits<float>::infinity());
+    for (int kk = -1; kk <= 1; kk++)
     {
-        return ID;
+        for (int jj = -1; jj <= 1; jj++)
+        {
+            int row = grid.Index(0, cellIndexY + jj, cellIndexZ + kk);
+            for (int c = firstCell; c <= lastCell; c++)
+            {
+                float dy = posY - pointY[row + c];
+                float dz = posZ - pointZ[row + c];
+                __m128 vC = _mm_set1_ps((float)c);
+                __m128 vPoint = _mm_set1_ps(pointX[row + c]);
+                __m128 vDy2 = _mm_set1_ps(dy * dy);
+                __m128 vDz2 = _mm_set1_ps(dz * dz);
+                for (int half = 0; half < 2; half++)
+                {
+                    __m128 inRange = _mm_and_ps(_mm_cmple_ps(_mm_sub_ps(vC, vCellX[half]), vOne), _mm_cmple_ps(_mm_sub_ps(vCellX[half], vC), vOne));
+                    __m128 dx = _mm_sub_ps(vPosX[half], vPoint);
+                    __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), vDy2), vDz2);
+                    dist = _mm_or_ps(_mm_and_ps(inRange, dist), _mm_andnot_ps(inRange, vFar));
+                    vMin[half] = _mm_min_ps(vMin[half], dist);
+                }
+            }
+        }
     }
-    unsigned int GetCount()
+    _mm_storeu_ps(result, vMin[0]);
+    _mm_storeu_ps(result + 4, vMin[1]);
+}
+#endif
+#if defined(WORLEY_SIMD_AVX2)
+WORLEY_TARGET_AVX2 void WorleyBlockAVX2(const FeaturePointGrid& grid, const float* posX, const float* cellX, float posY, float posZ, int cellIndexY, int cellIndexZ, float* result)
+{
+    const float* pointX = grid.GetX();
+    const float* pointY = grid.GetY();
+    const float* pointZ = grid.GetZ();
+    int firstCell = (int)cellX[0] - 1;
+    int lastCell = (int)cellX[7] + 1;
+
+    __m256 vPosX = _mm256_loadu_ps(posX);
+    __m256 vCellX = _mm256_loadu_ps(cellX);
+    __m256 vMin = _mm256_set1_ps(1000.0f);
+    __m256 vOne = _mm256_set1_ps(1.0f);
+    __m256 vFar = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+    for (int kk = -1; kk <= 1; kk++)
     {
-        return Count;
+        for (int jj = -1; jj <= 1; jj++)
+        {
+            int row = grid.Index(0, cellIndexY + jj, cellIndexZ + kk);
+            for (int c = firstCell; c <= lastCell; c++)
+            {
+                float dy = posY - pointY[row + c];
+                float dz = posZ - pointZ[row + c];
+                __m256 vC = _mm256_set1_ps((float)c);
+                __m256 inRange = _mm256_cmp_ps(_mm256_sub_ps(vC, vCellX), vOne, _CMP_LE_OQ);
+                inRange = _mm256_and_ps(inRange, _mm256_cmp_ps(_mm256_sub_ps(vCellX, vC), vOne, _CMP_LE_OQ));
+                __m256 dx = _mm256_sub_ps(vPosX, _mm256_set1_ps(pointX[row + c]));
+                __m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_set1_ps(dy * dy)), _mm256_set1_ps(dz * dz));
+                vMin = _mm256_min_ps(vMin, _mm256_blendv_ps(vFar, dist, inRange));
+            }
+        }
     }
-    void SubData(unsigned int* data, unsigned int count)
+    _mm256_storeu_ps(result, vMin);
+}
+#endif
+void WorleyRow(const FeaturePointGrid& grid, int dimX, int dimY, int dimZ, int j, int k, int startX, int endX, float* out, int stride, bool simd = true)
+{
+    // Squared Worley distance for voxels startX ... endX - 1 of row (j, k), eight at a time where the CPU has SIMD
+    int numCells = grid.GetNumCells();
+    float posY = 100.0f * ((float)(j + 0.5f) / (float)dimY);
+    float posZ = 100.0f * ((float)(k + 0.5f) / (float)dimZ);
+    int cellIndexY = WorleyCellIndex(posY, numCells);
+    int cellIndexZ = WorleyCellIndex(posZ, numCells);
+
+    int i = startX;
+#if defined(WORLEY_SIMD_SSE)
+    for (; simd && i + 8 <= endX; i += 8)
     {
-        // Substitute IBO data
-        Bind();
-        GLCall(glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, count * sizeof(unsigned int), data));
-        Unbind();
+        float posX[8], cellX[8], result[8];
+        for (int lane = 0; lane < 8; lane++)
+        {
+            posX[lane] = 100.0f * ((float)(i + lane + 0.5f) / (float)dimX);
+            cellX[lane] = (float)WorleyCellIndex(posX[lane], numCells);
+        }
+#if defined(WORLEY_SIMD_AVX2)
+        if (WorleyAvx2) WorleyBlockAVX2(grid, posX, cellX, posY, posZ, cellIndexY, cellIndexZ, result);
+        else
+#endif
+        WorleyBlockSSE(grid, posX, cellX, posY, posZ, cellIndexY, cellIndexZ, result);
+        for (int lane = 0; lane < 8; lane++) out[(i + lane - startX) * stride] = result[lane];
+    }
+#endif
+    // Scalar fallback and the tail of the row
+    for (; i < endX; i++)
+    {
+        glm::vec3 voxelPos = glm::vec3(100.0f * ((float)(i + 0.5f) / (float)dimX), posY, posZ);
+        out[(i - startX) * stride] = WorleyMinDistance(grid, voxelPos);
     }
+}
 
-};
-typedef struct
-{
-    unsigned int type;
-    unsigned int count;
-    unsigned char normalized;
-    unsigned int typeSize;
-}LayoutElement;
-class VertexBufferLayout
+float WorleyRange(const FeaturePointGrid& grid, int dim, ThreadPool* pool)
 {
-private:
-    std::vector<LayoutElement> Elements;
-    unsigned int layoutSize;
-public:
-    VertexBufferLayout()
+    // Largest squared Worley distance over the voxel centres of a dim^3 volume, from the feature
+    // grid alone. Boxes of voxels are searched best first: a box is bounded above by the farthest
+    // corner from each point that every voxel in it searches, and boxes that cannot beat the best
+    // voxel found so far are dropped, so only the few voxels near the maximum are evaluated. The
+    // result is the exact maximum a pass over every voxel would find.
+    int numCells = grid.GetNumCells();
+    if (dim < 4 * numCells)
     {
-        layoutSize = 0;
+        // Cells under four voxels wide leave nothing to prune, a plain pass over the voxels is cheaper
+        std::vector<float> sliceMax(dim, 0.0f);
+        ParallelFor(pool, dim, [&](int k)
+        {
+            std::vector<float> row(dim);
+            for (int j = 0; j < dim; j++)
+            {
+                WorleyRow(grid, dim, dim, dim, j, k, 0, dim, row.data(), 1);
+                sliceMax[k] = std::max(sliceMax[k], *std::max_element(row.begin(), row.end()));
+            }
+        });
+        return *std::max_element(sliceMax.begin(), sliceMax.end());
     }
 
-    template<typename T>
-    void Push(unsigned int count)
+    typedef struct
     {
-        /*static_assert(false);*/
+        int lo[3], hi[3]; // Inclusive voxel range
+        float bound;
+    }Box;
+    const float* point[3] = { grid.GetX(), grid.GetY(), grid.GetZ() };
+    std::vector<float> position(dim);
+    std::vector<int> cell(dim);
+    for (int i = 0; i < dim; i++)
+    {
+        position[i] = 100.0f * ((float)(i + 0.5f) / (float)dim);
+        cell[i] = WorleyCellIndex(position[i], numCells);
     }
+    auto upperBound = [&](Box& box)
+    {
+        // Cells within one of both the box's lowest and highest cell are searched by all its voxels
+        float lo[3], hi[3];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            lo[axis] = position[box.lo[axis]];
+            hi[axis] = position[box.hi[axis]];
+        }
+        box.bound = 1000.0f;
+        for (int k = cell[box.hi[2]] - 1; k <= cell[box.lo[2]] + 1; k++)
+        {
+            for (int j = cell[box.hi[1]] - 1; j <= cell[box.lo[1]] + 1; j++)
+            {
+                for (int i = cell[box.hi[0]] - 1; i <= cell[box.lo[0]] + 1; i++)
+                {
+                    int index = grid.Index(i, j, k);
+                    float farthest = 0.0f;
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        float dLo = lo[axis] - point[axis][index];
+                        float dHi = hi[axis] - point[axis][index];
+                        farthest += std::max(dLo * dLo, dHi * dHi);
+                    }
+                    box.bound = std::min(box.bound, farthest);
+                }
+            }
+        }
+    };
+    auto byBound = [](const Box& a, const Box& b) { return a.bound < b.bound; };
 
-    template <>
-    void Push<float>(unsigned int count)
+    // Start from the voxels of each cell, which all search the same 27 points, so the bounds are tight
+    std::vector<int> runLo, runHi;
+    for (int i = 0; i < dim; i++)
     {
-        Elements.push_back({ GL_FLOAT, count, GL_FALSE, sizeof(float) });
-        layoutSize += count * sizeof(float);
+        if (i == 0 || cell[i] != cell[i - 1])
+        {
+            runLo.push_back(i);
+            runHi.push_back(i);
+        }
+        else runHi.back() = i;
     }
+    int runs = (int)runLo.size();
+    std::vector<Box> heap((size_t)runs * runs * runs);
+    ParallelFor(pool, runs, [&](int runZ)
+    {
+        for (int runY = 0; runY < runs; runY++)
+        {
+            for (int runX = 0; runX < runs; runX++)
+            {
+                Box& box = heap[runX + (size_t)runs * (runY + (size_t)runs * runZ)];
+                int run[3] = { runX, runY, runZ };
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    box.lo[axis] = runLo[run[axis]];
+                    box.hi[axis] = runHi[run[axis]];
+                }
+                upperBound(box);
+            }
+        }
+    });
+    std::make_heap(heap.begin(), heap.end(), byBound);
 
-    template <>
-    void Push<int>(unsigned int count)
+    float best = 0.0f;
+    while (!heap.empty() && heap.front().bound > best)
     {
-        Elements.push_back({ GL_INT, count, GL_FALSE, sizeof(int) });
-        layoutSize += count * sizeof(unsigned int);
+        std::pop_heap(heap.begin(), heap.end(), byBound);
+        Box box = heap.back();
+        heap.pop_back();
+
+        // The centre voxel is a lower bound on the maximum, a single voxel is exact
+        int centre[3];
+        for (int axis = 0; axis < 3; axis++) centre[axis] = (box.lo[axis] + box.hi[axis]) / 2;
+        float dist;
+        WorleyRow(grid, dim, dim, dim, centre[1], centre[2], centre[0], centre[0] + 1, &dist, 1, false);
+        best = std::max(best, dist);
+
+        int axis = 0;
+        for (int a = 1; a < 3; a++) if (box.hi[a] - box.lo[a] > box.hi[axis] - box.lo[axis]) axis = a;
+        if (box.hi[axis] == box.lo[axis]) continue;
+
+        Box halves[2] = { box, box };
+        halves[0].hi[axis] = centre[axis];
+        halves[1].lo[axis] = centre[axis] + 1;
+        for (Box& half : halves)
+        {
+            upperBound(half);
+            if (half.bound <= best) continue;
+            heap.push_back(half);
+            std::push_heap(heap.begin(), heap.end(), byBound);
+        }
     }
+    return best;
+}
 
-    template <>
-    void Push<unsigned int>(unsigned int count)
+float Fade(float t)
+{
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+int WrapIndex(int i, int period)
+{
+    return ((i % period) + period) % period;
+}
+
+class TileableNoise
+{
+    // Fbm of value noise or gradient (Perlin) noise on a lattice that wraps every period cells.
+    // Each octave doubles the lattice and its period, so the sum still tiles. The corners of the
+    // last cell visited are kept per octave, so walking along a row only rehashes on cell changes.
+    // Keeps state, so use one instance per thread.
+private:
+    typedef struct
     {
-        Elements.push_back({ GL_UNSIGNED_INT, count, GL_FALSE, sizeof(unsigned int) });
-        layoutSize += count * sizeof(int);
+        int period;
+        unsigned int seed;
+        glm::ivec3 cell;
+        float value[8];        // Value noise corners
+        glm::vec3 gradient[8]; // Gradient noise corners
+    }Octave;
+
+    std::vector<Octave> octaves;
+    bool perlin;
+
+    void FetchCorners(Octave& octave, glm::ivec3 cell)
+    {
+        static const glm::vec3 gradients[12] = {
+            glm::vec3(1, 1, 0), glm::vec3(-1, 1, 0), glm::vec3(1, -1, 0), glm::vec3(-1, -1, 0),
+            glm::vec3(1, 0, 1), glm::vec3(-1, 0, 1), glm::vec3(1, 0, -1), glm::vec3(-1, 0, -1),
+            glm::vec3(0, 1, 1), glm::vec3(0, -1, 1), glm::vec3(0, 1, -1), glm::vec3(0, -1, -1)
+        };
+        // Stepping one cell along x keeps the four upper corners as the new lower ones
+        bool stepX = (cell.x == octave.cell.x + 1 && cell.y == octave.cell.y && cell.z == octave.cell.z);
+        octave.cell = cell;
+        for (int c = 0; c < 8; c++)
+        {
+            if (stepX && (c & 1) == 0)
+            {
+                octave.value[c] = octave.value[c + 1];
+                octave.gradient[c] = octave.gradient[c + 1];
+                continue;
+            }
+            int i = WrapIndex(cell.x + (c & 1), octave.period);
+            int j = WrapIndex(cell.y + ((c >> 1) & 1), octave.period);
+            int k = WrapIndex(cell.z + ((c >> 2) & 1), octave.period);
+            if (perlin) octave.gradient[c] = gradients[Hash(octave.seed ^ Hash(i + Hash(j + Hash(k)))) % 12];
+            else octave.value[c] = Random(octave.seed, i, j, k, 0);
+        }
     }
+    float SampleOctave(Octave& octave, glm::vec3 p)
+    {
+        glm::vec3 floored = glm::floor(p);
+        glm::ivec3 cell = glm::ivec3(floored);
+        if (cell != octave.cell) FetchCorners(octave, cell);
 
-    std::vector<LayoutElement> GetElements()
+        glm::vec3 t = p - floored;
+        glm::vec3 w = glm::vec3(Fade(t.x), Fade(t.y), Fade(t.z));
+
+        float corners[8];
+        for (int c = 0; c < 8; c++)
+        {
+            glm::vec3 corner = glm::vec3(c & 1, (c >> 1) & 1, (c >> 2) & 1);
+            corners[c] = perlin ? glm::dot(octave.gradient[c], t - corner) : octave.value[c];
+        }
+        float x00 = glm::mix(corners[0], corners[1], w.x);
+        float x10 = glm::mix(corners[2], corners[3], w.x);
+        float x01 = glm::mix(corners[4], corners[5], w.x);
+        float x11 = glm::mix(corners[6], corners[7], w.x);
+        return glm::mix(glm::mix(x00, x10, w.y), glm::mix(x01, x11, w.y), w.z);
+    }
+public:
+    TileableNoise(int period, int numOctaves, unsigned int seed, bool gradientNoise)
+    {
+        perlin = gradientNoise;
+        for (int o = 0; o < numOctaves; o++)
+        {
+            Octave octave;
+            octave.period = period << o;
+            octave.seed = Hash(seed + o);
+            octave.cell = glm::ivec3(std::numeric_limits<int>::min());
+            octaves.push_back(octave);
+        }
+    }
+    float Sample(glm::vec3 p)
+    {
+        // p in cells of the first octave. Value noise gives [0, 1], Perlin roughly [-1, 1]
+        float sum = 0.0f, amplitude = 1.0f, totalAmplitude = 0.0f;
+        for (size_t o = 0; o < octaves.size(); o++)
+        {
+            sum += amplitude * SampleOctave(octaves[o], p);
+            totalAmplitude += amplitude;
+            p *= 2.0f;
+            amplitude *= 0.5f;
+        }
+        return sum / totalAmplitude;
+    }
+};
+
+class NoiseGenerator
+{
+    // Tileable 3D noise volume written as 8 bit texels, one field per channel.
+    // Subclasses produce raw values a tile at a time; Generate() runs the tiles on the pool,
+    // reduces each channel's range and remaps it to [0, 1]. Very large volumes go through
+    // BeginSlabs() and GenerateSlabTexels() instead, a z slab at a time.
+protected:
+    NoiseSettings settings;
+
+    typedef struct
+    {
+        int startX, endX;
+        int startY, endY;
+        int startZ, endZ;
+        float* slab;    // Raw values of the slab the tile is in, four interleaved channels
+        int slabStartZ; // First slice of the slab
+    }Tile;
+
+    glm::vec3 CellPosition(int i, int j, int k, int frequency)
+    {
+        // Voxel centre in lattice cells of the given frequency
+        float res = (float)settings.resolution;
+        return glm::vec3((i + 0.5f) / res, (j + 0.5f) / res, (k + 0.5f) / res) * (float)frequency;
+    }
+    virtual void Prepare()
+    {
+    }
+    float* TileRow(const Tile& tile, int j, int k)
+    {
+        // Raw values of row (j, k) from the tile's first voxel on
+        size_t dim = (size_t)settings.resolution;
+        return &tile.slab[4 * (tile.startX + dim * (j + dim * (k - tile.slabStartZ)))];
+    }
+    // Raw values of every voxel in the tile, four interleaved channels. Only the first
+    // settings.channels of them are kept. Called once per pool task, so state set up
+    // here is shared by the tile's rows and by nothing else.
+    virtual void GenerateTile(const Tile& tile) = 0;
+    virtual bool KnownRange(ThreadPool* pool, float minValue[4], float maxValue[4])
+    {
+        // Generators that can bound their channels without generating the volume return true,
+        // which saves BeginSlabs() its full range pass. The rest are reduced from the values.
+        (void)pool;
+        (void)minValue;
+        (void)maxValue;
+        return false;
+    }
+    virtual void ChannelRemap(int channel, float minValue, float maxValue, float& scale, float& bias)
+    {
+        (void)channel;
+        // Stretch the channel's range over [0, 1]
+        scale = (maxValue > minValue) ? 1.0f / (maxValue - minValue) : 0.0f;
+        bias = -minValue * scale;
+    }
+    void GenerateSlab(ThreadPool* pool, int startZ, int endZ, float* values, float minValue[4], float maxValue[4])
+    {
+        // Raw values of slices startZ ... endZ - 1 into values, which starts at slice startZ
+        int dim = settings.resolution;
+
+        // Split the slab into tiles, each tile is one task for the pool
+        const int tileSize = 16;
+        int tiles = (dim + tileSize - 1) / tileSize;
+        int tilesZ = (endZ - startZ + tileSize - 1) / tileSize;
+        int numTiles = tiles * tiles * tilesZ;
+
+        // Range of each tile and channel, reduced after all tiles are done
+        std::vector<float> tileMin(numTiles * 4, std::numeric_limits<float>::max());
+        std::vector<float> tileMax(numTiles * 4, -std::numeric_limits<float>::max());
+
+        ParallelFor(pool, numTiles, [&](int index)
+        {
+            Tile tile;
+            tile.startX = (index % tiles) * tileSize;
+            tile.startY = ((index / tiles) % tiles) * tileSize;
+            tile.startZ = startZ + (index / (tiles * tiles)) * tileSize;
+            tile.endX = std::min(tile.startX + tileSize, dim);
+            tile.endY = std::min(tile.startY + tileSize, dim);
+            tile.endZ = std::min(tile.startZ + tileSize, endZ);
+            tile.slab = values;
+            tile.slabStartZ = startZ;
+            GenerateTile(tile);
+
+            for (int k = tile.startZ; k < tile.endZ; k++)
+            {
+                for (int j = tile.startY; j < tile.endY; j++)
+                {
+                    float* row = TileRow(tile, j, k);
+                    for (int i = 0; i < 4 * (tile.endX - tile.startX); i++)
+                    {
+                        int channel = i & 3;
+                        tileMin[channel + 4 * index] = std::min(tileMin[channel + 4 * index], row[i]);
+                        tileMax[channel + 4 * index] = std::max(tileMax[channel + 4 * index], row[i]);
+                    }
+                }
+            }
+        });
+
+        // Min and max are order independent, so the result does not depend on the thread count
+        for (int channel = 0; channel <= 3; channel++)
+        {
+            minValue[channel] = std::numeric_limits<float>::max();
+            maxValue[channel] = -std::numeric_limits<float>::max();
+            for (int tile = 0; tile < numTiles; tile++)
+            {
+                minValue[channel] = std::min(minValue[channel], tileMin[channel + 4 * tile]);
+                maxValue[channel] = std::max(maxValue[channel], tileMax[channel + 4 * tile]);
+            }
+        }
+    }
+    void Quantize(ThreadPool* pool, const float* values, int depth, const float scale[4], const float bias[4], unsigned char* texels, unsigned char* copy = nullptr)
+    {
+        // Remap and quantize the kept channels of depth slices, one z slice per task. Texels are only
+        // ever written, so they may point into a write only mapping; copy gets the same bytes if given.
+        int dim = settings.resolution;
+        int channels = settings.channels;
+        ParallelFor(pool, depth, [&](int k)
+        {
+            size_t start = (size_t)dim * dim * k;
+            for (size_t voxel = start; voxel < start + (size_t)dim * dim; voxel++)
+            {
+                for (int channel = 0; channel < channels; channel++)
+                {
+                    float value = values[4 * voxel + channel] * scale[channel] + bias[channel];
+                    unsigned char texel = (unsigned char)(glm::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+                    texels[channels * voxel + channel] = texel;
+                    if (copy) copy[channels * voxel + channel] = texel;
+                }
+            }
+        });
+    }
+public:
+    NoiseGenerator(const NoiseSettings& noiseSettings)
+        : settings(noiseSettings)
+    {
+    }
+    virtual ~NoiseGenerator()
+    {
+    }
+    virtual unsigned int GetVersion() = 0;
+    const char* GetName()
+    {
+        return NoiseGeneratorNames[settings.generator];
+    }
+    unsigned char* Generate(ThreadPool* pool)
+    {
+        Prepare();
+
+        int dim = settings.resolution;
+        std::vector<float> values((size_t)dim * dim * dim * 4);
+        unsigned char* texels = new unsigned char[NoiseVolumeBytes(settings)];
+
+        float minValue[4], maxValue[4], scale[4], bias[4];
+        GenerateSlab(pool, 0, dim, values.data(), minValue, maxValue);
+        KnownRange(pool, minValue, maxValue); // Same range as the slab path either way
+        for (int channel = 0; channel <= 3; channel++) ChannelRemap(channel, minValue[channel], maxValue[channel], scale[channel], bias[channel]);
+        Quantize(pool, values.data(), dim, scale, bias, texels);
+
+        return texels;
+    }
+    void BeginSlabs(ThreadPool* pool, int slabDepth, float* scratch, float scale[4], float bias[4])
+    {
+        // Slab by slab generation for volumes too large to hold as floats. Unless the generator
+        // knows its ranges, they need every voxel, so this first pass generates the whole volume
+        // once into the slabDepth deep scratch and keeps only the ranges. GenerateSlabTexels then
+        // regenerates each slab, which doubles the work but keeps host memory at O(slab).
+        Prepare();
+
+        int dim = settings.resolution;
+        float minValue[4], maxValue[4];
+        for (int channel = 0; channel <= 3; channel++)
+        {
+            minValue[channel] = std::numeric_limits<float>::max();
+            maxValue[channel] = -std::numeric_limits<float>::max();
+        }
+        if (!KnownRange(pool, minValue, maxValue))
+        {
+            for (int startZ = 0; startZ < dim; startZ += slabDepth)
+            {
+                float slabMin[4], slabMax[4];
+                GenerateSlab(pool, startZ, std::min(startZ + slabDepth, dim), scratch, slabMin, slabMax);
+                for (int channel = 0; channel <= 3; channel++)
+                {
+                    minValue[channel] = std::min(minValue[channel], slabMin[channel]);
+                    maxValue[channel] = std::max(maxValue[channel], slabMax[channel]);
+                }
+            }
+        }
+        for (int channel = 0; channel <= 3; channel++) ChannelRemap(channel, minValue[channel], maxValue[channel], scale[channel], bias[channel]);
+    }
+    void GenerateSlabTexels(ThreadPool* pool, int startZ, int endZ, float* scratch, const float scale[4], const float bias[4], unsigned char* texels, unsigned char* copy = nullptr)
+    {
+        // Texels of slices startZ ... endZ - 1, identical to the same slices of Generate()
+        float minValue[4], maxValue[4];
+        GenerateSlab(pool, startZ, endZ, scratch, minValue, maxValue);
+        Quantize(pool, scratch, endZ - startZ, scale, bias, texels, copy);
+    }
+    static NoiseGenerator* Create(const NoiseSettings& settings);
+};
+
+class WorleyNoise : public NoiseGenerator
+{
+    // Inverted distance to the nearest feature point, one frequency per channel
+private:
+    std::vector<FeaturePointGrid> grids;
+protected:
+    void Prepare() override
+    {
+        grids.clear();
+        for (int channel = 0; channel < settings.channels; channel++)
+        {
+            grids.push_back(FeaturePointGrid(settings.frequency[channel], Hash(settings.seed + channel)));
+        }
+    }
+    void GenerateTile(const Tile& tile) override
+    {
+        int dim = settings.resolution;
+        for (int k = tile.startZ; k < tile.endZ; k++)
+        {
+            for (int j = tile.startY; j < tile.endY; j++)
+            {
+                float* out = TileRow(tile, j, k);
+                for (int channel = 0; channel < 4; channel++)
+                {
+                    if (channel < settings.channels) WorleyRow(grids[channel], dim, dim, dim, j, k, tile.startX, tile.endX, out + channel, 4);
+                    else for (int i = 0; i < tile.endX - tile.startX; i++) out[4 * i + channel] = 0.0f;
+                }
+            }
+        }
+    }
+    bool KnownRange(ThreadPool* pool, float minValue[4], float maxValue[4]) override
+    {
+        // The largest distance follows from the feature points, only the maximum is used
+        for (int channel = 0; channel < settings.channels; channel++)
+        {
+            minValue[channel] = 0.0f;
+            maxValue[channel] = WorleyRange(grids[channel], settings.resolution, pool);
+        }
+        return true;
+    }
+    void ChannelRemap(int channel, float minValue, float maxValue, float& scale, float& bias) override
+    {
+        // 1 - dist / maxDist, near feature points is dense. A degenerate channel with no range,
+        // such as a single voxel on a feature point, is clamped so the texels stay finite
+        (void)channel;
+        (void)minValue;
+        scale = -1.0f / std::max(maxValue, 1e-6f);
+        bias = 1.0f;
+    }
+public:
+    WorleyNoise(const NoiseSettings& noiseSettings)
+        : NoiseGenerator(noiseSettings)
+    {
+    }
+    unsigned int GetVersion() override
+    {
+        return 3;
+    }
+};
+
+class PerlinWorleyNoise : public NoiseGenerator
+{
+    // R: perlin fbm remapped by worley fbm (billowy low frequency shapes)
+    // G, B, A: worley fbm at the remaining frequencies
+private:
+    std::vector<FeaturePointGrid> grids; // Three octaves per channel
+
+    void WorleyFbmRow(int channel, int j, int k, int startX, int endX, float* octave, float* out)
+    {
+        // octave is scratch for endX - startX values
+        int dim = settings.resolution;
+        int count = endX - startX;
+        const float weights[3] = { 0.625f, 0.25f, 0.125f };
+
+        for (int i = 0; i < count; i++) out[4 * i + channel] = 0.0f;
+        for (int o = 0; o < 3; o++)
+        {
+            const FeaturePointGrid& grid = grids[3 * channel + o];
+            float cellSize = 100.0f / grid.GetNumCells();
+            WorleyRow(grid, dim, dim, dim, j, k, startX, endX, octave, 1);
+            for (int i = 0; i < count; i++)
+            {
+                float worley = 1.0f - glm::clamp(std::sqrt(octave[i]) / cellSize, 0.0f, 1.0f);
+                out[4 * i + channel] += weights[o] * worley;
+            }
+        }
+    }
+protected:
+    void Prepare() override
+    {
+        grids.clear();
+        for (int channel = 0; channel < settings.channels; channel++)
+        {
+            for (int o = 0; o < 3; o++)
+            {
+                int frequency = settings.frequency[channel] << o;
+                grids.push_back(FeaturePointGrid(frequency, Hash(settings.seed + 16 * channel + o)));
+            }
+        }
+    }
+    void GenerateTile(const Tile& tile) override
+    {
+        std::vector<float> octave(tile.endX - tile.startX);
+        TileableNoise perlinFbm(settings.frequency[0], settings.octaves, settings.seed, true);
+        for (int k = tile.startZ; k < tile.endZ; k++)
+        {
+            for (int j = tile.startY; j < tile.endY; j++)
+            {
+                float* out = TileRow(tile, j, k);
+                for (int channel = 0; channel < 4; channel++)
+                {
+                    if (channel < settings.channels) WorleyFbmRow(channel, j, k, tile.startX, tile.endX, octave.data(), out);
+                    else for (int i = 0; i < tile.endX - tile.startX; i++) out[4 * i + channel] = 0.0f;
+                }
+
+                for (int i = tile.startX; i < tile.endX; i++)
+                {
+                    glm::vec3 p = CellPosition(i, j, k, settings.frequency[0]);
+                    float perlin = 0.5f + 0.5f * perlinFbm.Sample(p);
+                    float worley = out[4 * (i - tile.startX)];
+                    out[4 * (i - tile.startX)] = worley + perlin * (1.0f - worley); // remap(perlin, 0, 1, worley, 1)
+                }
+            }
+        }
+    }
+public:
+    PerlinWorleyNoise(const NoiseSettings& noiseSettings)
+        : NoiseGenerator(noiseSettings)
+    {
+    }
+    unsigned int GetVersion() override
+    {
+        return 1;
+    }
+};
+
+class CurlNoise : public NoiseGenerator
+{
+    // RGB: curl of a perlin fbm vector potential, A: its magnitude. Divergence free,
+    // meant for distorting the lookup of the other volumes rather than as density.
+protected:
+    void GenerateTile(const Tile& tile) override
+    {
+        // The potential is evaluated once per voxel of the tile plus a one voxel halo, then the
+        // curl is taken from central differences between neighbouring voxels. The potential
+        // tiles, so voxels past the volume edge are fine to evaluate.
+        int period = settings.frequency[0];
+        TileableNoise fields[3] = {
+            TileableNoise(period, settings.octaves, Hash(settings.seed), true),
+            TileableNoise(period, settings.octaves, Hash(settings.seed + 1), true),
+            TileableNoise(period, settings.octaves, Hash(settings.seed + 2), true)
+        };
+        int sizeX = tile.endX - tile.startX + 2;
+        int sizeY = tile.endY - tile.startY + 2;
+        int sizeZ = tile.endZ - tile.startZ + 2;
+        std::vector<glm::vec3> potential((size_t)sizeX * sizeY * sizeZ);
+        for (int k = 0; k < sizeZ; k++)
+        {
+            for (int j = 0; j < sizeY; j++)
+            {
+                glm::vec3* row = &potential[(size_t)sizeX * (j + (size_t)sizeY * k)];
+                for (int i = 0; i < sizeX; i++)
+                {
+                    glm::vec3 p = CellPosition(tile.startX - 1 + i, tile.startY - 1 + j, tile.startZ - 1 + k, period);
+                    row[i] = glm::vec3(fields[0].Sample(p), fields[1].Sample(p), fields[2].Sample(p));
+                }
+            }
+        }
+
+        float spacing = 2.0f * settings.frequency[0] / settings.resolution;
+        int strideY = sizeX;
+        int strideZ = sizeX * sizeY;
+        for (int k = tile.startZ; k < tile.endZ; k++)
+        {
+            for (int j = tile.startY; j < tile.endY; j++)
+            {
+                float* out = TileRow(tile, j, k);
+                const glm::vec3* centre = &potential[1 + (size_t)sizeX * ((j - tile.startY + 1) + (size_t)sizeY * (k - tile.startZ + 1))];
+                for (int i = 0; i < tile.endX - tile.startX; i++)
+                {
+                    glm::vec3 ddx = (centre[i + 1] - centre[i - 1]) / spacing;
+                    glm::vec3 ddy = (centre[i + strideY] - centre[i - strideY]) / spacing;
+                    glm::vec3 ddz = (centre[i + strideZ] - centre[i - strideZ]) / spacing;
+                    glm::vec3 curl = glm::vec3(ddy.z - ddz.y, ddz.x - ddx.z, ddx.y - ddy.x);
+
+                    float* texel = &out[4 * i];
+                    texel[0] = curl.x;
+                    texel[1] = curl.y;
+                    texel[2] = curl.z;
+                    texel[3] = glm::length(curl);
+                }
+            }
+        }
+    }
+    void ChannelRemap(int channel, float minValue, float maxValue, float& scale, float& bias) override
+    {
+        if (channel == 3) return NoiseGenerator::ChannelRemap(channel, 0.0f, maxValue, scale, bias);
+
+        // Keep zero at 0.5 so the vector stays unbiased
+        float extent = std::max(std::abs(minValue), std::abs(maxValue));
+        scale = (extent > 0.0f) ? 0.5f / extent : 0.0f;
+        bias = 0.5f;
+    }
+public:
+    CurlNoise(const NoiseSettings& noiseSettings)
+        : NoiseGenerator(noiseSettings)
+    {
+    }
+    unsigned int GetVersion() override
+    {
+        return 1;
+    }
+};
+
+class ValueNoise : public NoiseGenerator
+{
+    // Value noise fbm, one base frequency per channel. Cheapest of the generators.
+protected:
+    void GenerateTile(const Tile& tile) override
+    {
+        for (int channel = 0; channel < 4; channel++)
+        {
+            TileableNoise valueFbm(settings.frequency[channel], settings.octaves, Hash(settings.seed + channel), false);
+            for (int k = tile.startZ; k < tile.endZ; k++)
+            {
+                for (int j = tile.startY; j < tile.endY; j++)
+                {
+                    float* out = TileRow(tile, j, k);
+                    for (int i = tile.startX; i < tile.endX; i++)
+                    {
+                        glm::vec3 p = CellPosition(i, j, k, settings.frequency[channel]);
+                        out[4 * (i - tile.startX) + channel] = (channel < settings.channels) ? valueFbm.Sample(p) : 0.0f;
+                    }
+                }
+            }
+        }
+    }
+public:
+    ValueNoise(const NoiseSettings& noiseSettings)
+        : NoiseGenerator(noiseSettings)
+    {
+    }
+    unsigned int GetVersion() override
+    {
+        return 1;
+    }
+};
+
+NoiseGenerator* NoiseGenerator::Create(const NoiseSettings& settings)
+{
+    if (settings.generator == 1) return new PerlinWorleyNoise(settings);
+    if (settings.generator == 2) return new CurlNoise(settings);
+    if (settings.generator == 3) return new ValueNoise(settings);
+    return new WorleyNoise(settings);
+}
+
+class MappedFile
+{
+    // Read only memory map of a whole file
+private:
+    const unsigned char* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int file;
+#endif
+public:
+    MappedFile(const std::string& path)
+        : data(nullptr), size(0)
+    {
+#ifdef _WIN32
+        mapping = NULL;
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return;
+
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) return;
+
+        data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (data) size = (size_t)fileSize.QuadPart;
+#else
+        file = open(path.c_str(), O_RDONLY);
+        if (file < 0) return;
+
+        struct stat info;
+        if (fstat(file, &info) != 0 || info.st_size == 0) return;
+
+        void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (view == MAP_FAILED) return;
+
+        data = (const unsigned char*)view;
+        size = (size_t)info.st_size;
+#endif
+    }
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping != NULL) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (data) munmap((void*)data, size);
+        if (file >= 0) close(file);
+#endif
+    }
+    bool IsOpen()
+    {
+        return data != nullptr;
+    }
+    const unsigned char* GetData()
+    {
+        return data;
+    }
+    size_t GetSize()
+    {
+        return size;
+    }
+};
+
+class CacheFile
+{
+    // Write side of the on disk caches. Texels go to a temporary file next to the target that
+    // Commit swaps in, so readers never see a half written file. Dropped without Commit it is removed.
+private:
+    std::string path;
+    std::string tempPath;
+    std::ofstream file;
+public:
+    CacheFile(const std::string& filePath)
+        : path(filePath), tempPath(filePath + ".tmp")
+    {
+        std::string directory = path.substr(0, path.find_last_of('/'));
+#ifdef _WIN32
+        _mkdir(directory.c_str());
+#else
+        mkdir(directory.c_str(), 0755);
+#endif
+        file.open(tempPath, std::ios::out | std::ios::binary);
+    }
+    ~CacheFile()
+    {
+        if (file.is_open())
+        {
+            file.close();
+            std::remove(tempPath.c_str());
+        }
+    }
+    bool IsOpen()
+    {
+        return file.is_open();
+    }
+    const std::string& GetPath()
+    {
+        return path;
+    }
+    void Write(const void* data, size_t bytes)
+    {
+        file.write((const char*)data, bytes);
+    }
+    bool Commit()
+    {
+        bool written = file.good();
+        file.close();
+
+        std::remove(path.c_str());
+        if (!written || std::rename(tempPath.c_str(), path.c_str()) != 0)
+        {
+            std::remove(tempPath.c_str());
+            return false;
+        }
+        return true;
+    }
+};
+
+typedef struct
+{
+    char magic[4];                 // "CLDN"
+    unsigned int formatVersion;    // Layout of this header
+    int generator;                 // Index into NoiseGeneratorNames
+    unsigned int generatorVersion; // Bumped whenever generated texels change
+    int resolution;
+    int frequency[4];
+    int octaves;
+    unsigned int seed;
+    unsigned int channels;
+    uint64_t dataSize;             // Bytes of texels following the header, wide enough for any volume
+}NoiseCacheHeader;
+
+class NoiseCache
+{
+    // On disk cache of generated noise volumes: a NoiseCacheHeader followed by raw 8 bit texels.
+    // Files are memory mapped on load so the texels go straight to the texture upload.
+private:
+    std::string directory;
+
+    std::string GetPath(const NoiseSettings& settings)
+    {
+        std::stringstream ss;
+        ss << directory << "/" << NoiseGeneratorNames[settings.generator] << "_" << settings.resolution << "x" << settings.channels << "_"
+            << settings.frequency[0] << "-" << settings.frequency[1] << "-" << settings.frequency[2] << "-" << settings.frequency[3]
+            << "_" << settings.octaves << "_" << settings.seed << ".bin";
+        return ss.str();
+    }
+    NoiseCacheHeader MakeHeader(const NoiseSettings& settings, unsigned int generatorVersion, uint64_t dataSize)
+    {
+        NoiseCacheHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "CLDN", 4);
+        header.formatVersion = FormatVersion;
+        header.generator = settings.generator;
+        header.generatorVersion = generatorVersion;
+        header.resolution = settings.resolution;
+        for (int i = 0; i < 4; i++) header.frequency[i] = settings.frequency[i];
+        header.octaves = settings.octaves;
+        header.seed = settings.seed;
+        header.channels = settings.channels;
+        header.dataSize = dataSize;
+        return header;
+    }
+public:
+    static const unsigned int FormatVersion = 3;
+
+    NoiseCache(const std::string& dir)
+        : directory(dir)
+    {
+    }
+    MappedFile* Load(const NoiseSettings& settings, unsigned int generatorVersion)
+    {
+        // Returns the mapped file when its header matches the settings, texels start after the header.
+        // The header's dataSize is compared too, so it always agrees with the mapped length.
+        uint64_t dataSize = NoiseVolumeBytes(settings);
+
+        MappedFile* file = new MappedFile(GetPath(settings));
+        if (!file->IsOpen() || file->GetSize() != sizeof(NoiseCacheHeader) + dataSize)
+        {
+            delete file;
+            return nullptr;
+        }
+
+        NoiseCacheHeader expected = MakeHeader(settings, generatorVersion, dataSize);
+        if (std::memcmp(file->GetData(), &expected, sizeof(NoiseCacheHeader)) != 0)
+        {
+            delete file;
+            return nullptr;
+        }
+        return file;
+    }
+    void Store(const NoiseSettings& settings, unsigned int generatorVersion, const unsigned char* texels)
+    {
+        CacheFile* file = BeginStore(settings, generatorVersion);
+        if (!file) return;
+        file->Write(texels, NoiseVolumeBytes(settings));
+        EndStore(file, true);
+    }
+    CacheFile* BeginStore(const NoiseSettings& settings, unsigned int generatorVersion)
+    {
+        // Opens the file and writes the header, the caller appends the texels in z order and hands it to EndStore
+        CacheFile* file = new CacheFile(GetPath(settings));
+        if (!file->IsOpen())
+        {
+            std::cerr << "Could not write noise cache " << file->GetPath() << std::endl;
+            delete file;
+            return nullptr;
+        }
+        NoiseCacheHeader header = MakeHeader(settings, generatorVersion, NoiseVolumeBytes(settings));
+        file->Write(&header, sizeof(header));
+        return file;
+    }
+    void EndStore(CacheFile* file, bool complete)
+    {
+        // Swaps a complete file in, one cut short is discarded
+        if (complete && !file->Commit()) std::cerr << "Could not write noise cache " << file->GetPath() << std::endl;
+        delete file;
+    }
+};
+typedef struct
+{
+    char magic[4];              // "CLDB"
+    unsigned int formatVersion; // Bumped whenever generated ranks change
+    int width;                  // Texels along x and y
+    int depth;                  // Slices, 1 for plain 2D blue noise
+    unsigned int seed;
+    unsigned int padding;       // Always 0, keeps dataSize 8 byte aligned
+    uint64_t dataSize;          // Bytes of texels following the header
+}BlueNoiseHeader;
+
+class BlueNoise
+{
+    // Tileable blue noise from void-and-cluster, 8 bit ranks in a width x width x depth volume.
+    // The energy of a pixel is a Gaussian of the toroidal distance to every set pixel in its own
+    // slice plus one along the slices at the same pixel, so each slice is blue noise by itself and
+    // so is every pixel's sequence over the slices (spatiotemporal blue noise). The initial energy
+    // is gathered row by row on the pool, after that only rows near a toggled pixel change and
+    // each row keeps its own void and cluster.
+    // Results are cached like the noise volumes.
+private:
+    typedef struct
+    {
+        std::vector<float> energy;
+        std::vector<unsigned char> bits;
+        std::vector<float> rowVoid;       // Lowest energy of an unset pixel per row
+        std::vector<int> rowVoidIndex;    // -1 when the row is full
+        std::vector<float> rowCluster;    // Highest energy of a set pixel per row
+        std::vector<int> rowClusterIndex; // -1 when the row is empty
+    }State;
+
+    int width, depth;
+    unsigned int seed;
+    int radius, temporalRadius;
+    std::vector<float> spatialKernel, temporalKernel; // Indexed by offset + radius
+    std::vector<unsigned char> texels;
+
+    static const unsigned int FormatVersion = 4;
+
+    std::string GetPath()
+    {
+        std::stringstream ss;
+        ss << "resources/cache/BlueNoise_" << width << "x" << width << "x" << depth << "_" << seed << ".bin";
+        return ss.str();
+    }
+    BlueNoiseHeader MakeHeader()
+    {
+        BlueNoiseHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "CLDB", 4);
+        header.formatVersion = FormatVersion;
+        header.width = width;
+        header.depth = depth;
+        header.seed = seed;
+        header.dataSize = texels.size();
+        return header;
+    }
+    void UpdateRow(State& state, int row)
+    {
+        // Void and cluster of one row of width pixels
+        state.rowVoid[row] = std::numeric_limits<float>::max();
+        state.rowCluster[row] = -std::numeric_limits<float>::max();
+        state.rowVoidIndex[row] = -1;
+        state.rowClusterIndex[row] = -1;
+        for (int i = row * width; i < (row + 1) * width; i++)
+        {
+            if (!state.bits[i] && state.energy[i] < state.rowVoid[row])
+            {
+                state.rowVoid[row] = state.energy[i];
+                state.rowVoidIndex[row] = i;
+            }
+            if (state.bits[i] && state.energy[i] > state.rowCluster[row])
+            {
+                state.rowCluster[row] = state.energy[i];
+                state.rowClusterIndex[row] = i;
+            }
+        }
+    }
+    void Toggle(State& state, int pixel)
+    {
+        // Flip one pixel and add or remove its energy splat, rows are (y, slice) pairs. A splat
+        // touches a few dozen short rows, about as much work as waking the pool would cost, and
+        // every toggle depends on the previous one, so toggles stay serial and only Splat is pooled.
+        int x = pixel % width, y = (pixel / width) % width, slice = pixel / (width * width);
+        float sign = state.bits[pixel] ? -1.0f : 1.0f;
+        state.bits[pixel] = !state.bits[pixel];
+
+        for (int dy = -radius; dy <= radius; dy++)
+        {
+            int row = WrapIndex(y + dy, width) + width * slice;
+            float* energy = &state.energy[row * width];
+            float weight = sign * spatialKernel[dy + radius];
+            for (int dx = -radius; dx <= radius; dx++) energy[WrapIndex(x + dx, width)] += weight * spatialKernel[dx + radius];
+            UpdateRow(state, row);
+        }
+        for (int dt = -temporalRadius; dt <= temporalRadius; dt++)
+        {
+            if (dt == 0) continue;
+            int row = y + width * WrapIndex(slice + dt, depth);
+            state.energy[row * width + x] += sign * temporalKernel[dt + temporalRadius];
+            UpdateRow(state, row);
+        }
+    }
+    void Splat(State& state, ThreadPool* pool)
+    {
+        // Energy of every pixel from the set bits at once, each row gathers its own neighbourhood on the pool
+        ParallelFor(pool, width * depth, [&](int row)
+        {
+            int y = row % width, slice = row / width;
+            float* energy = &state.energy[row * width];
+            for (int x = 0; x < width; x++)
+            {
+                float sum = 0.0f;
+                for (int dy = -radius; dy <= radius; dy++)
+                {
+                    const unsigned char* bits = &state.bits[(WrapIndex(y + dy, width) + width * slice) * width];
+                    float rowSum = 0.0f;
+                    for (int dx = -radius; dx <= radius; dx++) rowSum += bits[WrapIndex(x + dx, width)] * spatialKernel[dx + radius];
+                    sum += rowSum * spatialKernel[dy + radius];
+                }
+                for (int dt = -temporalRadius; dt <= temporalRadius; dt++)
+                {
+                    if (dt != 0) sum += state.bits[(y + width * WrapIndex(slice + dt, depth)) * width + x] * temporalKernel[dt + temporalRadius];
+                }
+                energy[x] = sum;
+            }
+            UpdateRow(state, row);
+        });
+    }
+    int LargestVoid(const State& state)
+    {
+        // First row wins ties, so the result does not depend on the thread count
+        int best = -1;
+        for (int row = 0; row < (int)state.rowVoid.size(); row++)
+        {
+            if (state.rowVoidIndex[row] >= 0 && (best < 0 || state.rowVoid[row] < state.rowVoid[best])) best = row;
+        }
+        return best < 0 ? -1 : state.rowVoidIndex[best];
+    }
+    int TightestCluster(const State& state)
+    {
+        int best = -1;
+        for (int row = 0; row < (int)state.rowCluster.size(); row++)
+        {
+            if (state.rowClusterIndex[row] >= 0 && (best < 0 || state.rowCluster[row] > state.rowCluster[best])) best = row;
+        }
+        return best < 0 ? -1 : state.rowClusterIndex[best];
+    }
+    void Generate(ThreadPool* pool)
+    {
+        int count = width * width * depth;
+        int rows = width * depth;
+
+        // Separable Gaussians, sigma 1.9 texels and 1.9 slices, cut at three sigma or half the period
+        const float sigma = 1.9f;
+        radius = std::min((int)std::ceil(3.0f * sigma), (width - 1) / 2);
+        temporalRadius = std::min((int)std::ceil(3.0f * sigma), (depth - 1) / 2);
+        for (int d = -radius; d <= radius; d++) spatialKernel.push_back(std::exp(-(float)(d * d) / (2.0f * sigma * sigma)));
+        for (int d = -temporalRadius; d <= temporalRadius; d++) temporalKernel.push_back(std::exp(-(float)(d * d) / (2.0f * sigma * sigma)));
+
+        State prototype;
+        prototype.energy.assign(count, 0.0f);
+        prototype.bits.assign(count, 0);
+        prototype.rowVoid.resize(rows);
+        prototype.rowVoidIndex.resize(rows);
+        prototype.rowCluster.resize(rows);
+        prototype.rowClusterIndex.resize(rows);
+
+        // Initial binary pattern, a tenth of the pixels set at random
+        for (int i = 0; i < count; i++)
+        {
+            int x = i % width, y = (i / width) % width, slice = i / (width * width);
+            prototype.bits[i] = Random(seed, x, y, slice, 0) < 0.1f;
+        }
+        Splat(prototype, pool);
+
+        // Move the tightest cluster into the largest void until that would undo itself
+        for (int iteration = 0; iteration < count; iteration++)
+        {
+            int cluster = TightestCluster(prototype);
+            Toggle(prototype, cluster);
+            int largestVoid = LargestVoid(prototype);
+            Toggle(prototype, largestVoid);
+            if (largestVoid == cluster) break;
+        }
+
+        std::vector<int> ranks(count);
+        int ones = 0;
+        for (int i = 0; i < count; i++) ones += prototype.bits[i];
+
+        // Ranks below the pattern: remove clusters one by one
+        State state = prototype;
+        for (int rank = ones - 1; rank >= 0; rank--)
+        {
+            int cluster = TightestCluster(state);
+            ranks[cluster] = rank;
+            Toggle(state, cluster);
+        }
+
+        // Ranks above it: fill the largest voids up to half the pixels
+        int half = count / 2;
+        for (int rank = ones; rank < half; rank++)
+        {
+            int largestVoid = LargestVoid(prototype);
+            ranks[largestVoid] = rank;
+            Toggle(prototype, largestVoid);
+        }
+
+        // Past half the unset pixels are the minority, so the pattern is inverted and its tightest
+        // cluster of unset pixels is set next, with the energy splatted from those instead
+        for (int i = 0; i < count; i++) prototype.bits[i] = !prototype.bits[i];
+        Splat(prototype, pool);
+        for (int rank = std::max(ones, half); rank < count; rank++)
+        {
+            int cluster = TightestCluster(prototype);
+            ranks[cluster] = rank;
+            Toggle(prototype, cluster);
+        }
+
+        texels.resize(count);
+        for (int i = 0; i < count; i++) texels[i] = (unsigned char)((size_t)ranks[i] * 256 / count);
+    }
+
+public:
+    BlueNoise(int size, int slices, unsigned int noiseSeed, ThreadPool* pool)
+        : width(size), depth(slices), seed(noiseSeed), radius(0), temporalRadius(0)
+    {
+        size_t count = (size_t)width * width * depth;
+        MappedFile file(GetPath());
+        texels.resize(count);
+        BlueNoiseHeader expected = MakeHeader();
+        if (file.IsOpen() && file.GetSize() == sizeof(BlueNoiseHeader) + count && std::memcmp(file.GetData(), &expected, sizeof(expected)) == 0)
+        {
+            std::memcpy(texels.data(), file.GetData() + sizeof(BlueNoiseHeader), count);
+            std::cout << "Blue noise " << width << "x" << width << "x" << depth << " loaded from cache" << std::endl;
+            return;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        Generate(pool);
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Blue noise " << width << "x" << width << "x" << depth << " generated in "
+            << std::chrono::duration<float, std::milli>(end - start).count() << " ms" << std::endl;
+
+        CacheFile out(GetPath());
+        BlueNoiseHeader header = MakeHeader();
+        out.Write(&header, sizeof(header));
+        out.Write(texels.data(), texels.size());
+        if (!out.Commit()) std::cerr << "Could not write blue noise cache " << out.GetPath() << std::endl;
+    }
+    int GetWidth() const { return width; }
+    int GetDepth() const { return depth; }
+    const unsigned char* GetTexels() const { return texels.data(); }
+};
+class NoiseVolume
+{
+    // 8 bit texels of one noise volume, mapped from the cache or generated and then cached
+private:
+    NoiseSettings settings;
+    MappedFile* mapped;
+    unsigned char* generated;
+
+public:
+    NoiseVolume(const NoiseSettings& noiseSettings, ThreadPool* pool)
+        : settings(noiseSettings), mapped(nullptr), generated(nullptr)
+    {
+        const int dim = settings.resolution;
+        NoiseGenerator* generator = NoiseGenerator::Create(settings);
+        NoiseCache cache("resources/cache");
+        mapped = cache.Load(settings, generator->GetVersion());
+        if (mapped)
+        {
+            std::cout << generator->GetName() << " noise " << dim << "x" << dim << "x" << dim << " loaded from cache" << std::endl;
+        }
+        else
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            generated = generator->Generate(pool);
+            auto end = std::chrono::high_resolution_clock::now();
+            std::cout << generator->GetName() << " noise " << dim << "x" << dim << "x" << dim << " generated in "
+                << std::chrono::duration<float, std::milli>(end - start).count() << " ms on "
+                << (pool ? pool->GetThreadCount() : 1) << " threads" << std::endl;
+
+            cache.Store(settings, generator->GetVersion(), generated);
+        }
+        delete generator;
+    }
+    ~NoiseVolume()
+    {
+        delete mapped;
+        delete[] generated;
+    }
+    const NoiseSettings& GetSettings() const { return settings; }
+    const unsigned char* GetTexels() const
+    {
+        if (mapped) return mapped->GetData() + sizeof(NoiseCacheHeader);
+        return generated;
+    }
+    float Texel(int i, int j, int k, int channel) const
+    {
+        int dim = settings.resolution;
+        i = WrapIndex(i, dim); j = WrapIndex(j, dim); k = WrapIndex(k, dim);
+        return GetTexels()[((size_t)dim * dim * k + (size_t)dim * j + i) * settings.channels + channel] / 255.0f;
+    }
+    float Sample(glm::vec3 uvw, int channel) const
+    {
+        // Trilinear with wrapping, the same lookup the GL_REPEAT / GL_LINEAR texture does
+        glm::vec3 p = uvw * (float)settings.resolution - 0.5f;
+        glm::vec3 cell = glm::floor(p);
+        glm::vec3 t = p - cell;
+        int i = (int)cell.x, j = (int)cell.y, k = (int)cell.z;
+
+        float c00 = glm::mix(Texel(i, j, k, channel), Texel(i + 1, j, k, channel), t.x);
+        float c10 = glm::mix(Texel(i, j + 1, k, channel), Texel(i + 1, j + 1, k, channel), t.x);
+        float c01 = glm::mix(Texel(i, j, k + 1, channel), Texel(i + 1, j, k + 1, channel), t.x);
+        float c11 = glm::mix(Texel(i, j + 1, k + 1, channel), Texel(i + 1, j + 1, k + 1, channel), t.x);
+        return glm::mix(glm::mix(c00, c10, t.y), glm::mix(c01, c11, t.y), t.z);
+    }
+};
+const float DensityThreshold = 0.75f; // Density below this is air, matches DensityThreshold in density.glsl
+
+class DensityVolume
+{
+    // Single channel cloud density baked from the shape and detail volumes. Holds the value
+    // DensityAtSamplePoint computes before its threshold, so the shaders only fetch and compare.
+private:
+    int resolution;
+    bool halfFloat;
+    std::vector<unsigned char> r8;
+    std::vector<unsigned short> r16f;
+
+public:
+    DensityVolume(const NoiseVolume& shape, const NoiseVolume& detail, float detailScale, bool useHalfFloat, ThreadPool* pool)
+        : resolution(shape.GetSettings().resolution), halfFloat(useHalfFloat)
+    {
+        const int dim = resolution;
+        size_t count = (size_t)dim * dim * dim;
+        if (halfFloat) r16f.resize(count);
+        else r8.resize(count);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        ParallelFor(pool, dim, [&](int k)
+        {
+            for (int j = 0; j < dim; j++)
+            {
+                for (int i = 0; i < dim; i++)
+                {
+                    // Voxel centres of the shape volume, the detail is sampled where the shader would
+                    glm::vec3 uvw = (glm::vec3((float)i, (float)j, (float)k) + 0.5f) / (float)dim;
+                    float shapeProduct = shape.Texel(i, j, k, 0) * shape.Texel(i, j, k, 1);
+                    float detailProduct = detail.Sample(uvw * detailScale, 0) * detail.Sample(uvw * detailScale, 1);
+                    float density = std::pow(shapeProduct * detailProduct, 0.3f);
+
+                    size_t voxel = (size_t)dim * dim * k + (size_t)dim * j + i;
+                    if (halfFloat) r16f[voxel] = glm::packHalf1x16(density);
+                    else r8[voxel] = (unsigned char)(glm::clamp(density, 0.0f, 1.0f) * 255.0f + 0.5f);
+                }
+            }
+        });
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Density " << dim << "x" << dim << "x" << dim << (halfFloat ? " R16F" : " R8") << " baked in "
+            << std::chrono::duration<float, std::milli>(end - start).count() << " ms" << std::endl;
+    }
+    int GetResolution() const { return resolution; }
+    bool IsHalfFloat() const { return halfFloat; }
+    const void* GetData() const
+    {
+        if (halfFloat) return (const void*)r16f.data();
+        return (const void*)r8.data();
+    }
+    size_t GetBytes() const { return halfFloat ? r16f.size() * sizeof(unsigned short) : r8.size(); }
+    float Texel(int i, int j, int k) const
+    {
+        size_t voxel = (size_t)resolution * resolution * k + (size_t)resolution * j + i;
+        return halfFloat ? glm::unpackHalf1x16(r16f[voxel]) : r8[voxel] / 255.0f;
+    }
+};
+class MaxDensityGrid
+{
+    // Upper bound of the cloud density over 4^3 texel macro cells of the noise period, for empty space
+    // skipping. Each cell covers one more texel around it because trilinear filtering reaches that far.
+private:
+    int resolution;
+    std::vector<unsigned char> cells;            // R8, rounded up so the bound never drops below the density
+    std::vector<unsigned char> occupiedSlabs[3]; // Per axis, whether any cell of that slab can pass the threshold
+
+    template<typename CellBound>
+    void Build(int dim, const char* source, ThreadPool* pool, CellBound cellBound)
+    {
+        // cellBound(lo, hi) bounds the density over texels lo ... hi, which may run past the wrap
+        resolution = std::max(dim / CellTexels, 1);
+        const int cellTexels = dim / resolution;
+        cells.resize((size_t)resolution * resolution * resolution);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        ParallelFor(pool, resolution, [&](int ck)
+        {
+            for (int cj = 0; cj < resolution; cj++)
+            {
+                for (int ci = 0; ci < resolution; ci++)
+                {
+                    glm::ivec3 lo = glm::ivec3(ci, cj, ck) * cellTexels - 1;
+                    float bound = cellBound(lo, lo + cellTexels + 1);
+                    cells[(size_t)resolution * resolution * ck + (size_t)resolution * cj + ci] = (unsigned char)std::ceil(glm::clamp(bound, 0.0f, 1.0f) * 255.0f);
+                }
+            }
+        });
+
+        int occupied = 0;
+        for (int axis = 0; axis < 3; axis++) occupiedSlabs[axis].assign(resolution, 0);
+        for (int ck = 0; ck < resolution; ck++)
+        {
+            for (int cj = 0; cj < resolution; cj++)
+            {
+                for (int ci = 0; ci < resolution; ci++)
+                {
+                    if (cells[(size_t)resolution * resolution * ck + (size_t)resolution * cj + ci] / 255.0f < DensityThreshold) continue;
+                    occupiedSlabs[0][ci] = occupiedSlabs[1][cj] = occupiedSlabs[2][ck] = 1;
+                    occupied++;
+                }
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Max density grid " << resolution << "^3 from " << source << " built in " << std::chrono::duration<float, std::milli>(end - start).count()
+            << " ms, " << occupied * 100 / (int)cells.size() << "% of cells occupied" << std::endl;
+    }
+
+public:
+    static const int CellTexels = 4;
+
+    MaxDensityGrid(const NoiseVolume& shape, ThreadPool* pool)
+    {
+        // Raw noise: the detail only lowers the density, and the filtered channels are each at most their
+        // largest texel, so the shape's per channel maxima bound the density
+        const int dim = shape.GetSettings().resolution;
+        const int channels = shape.GetSettings().channels;
+        const unsigned char* texels = shape.GetTexels();
+        Build(dim, "shape noise", pool, [&](glm::ivec3 lo, glm::ivec3 hi)
+        {
+            unsigned char maxShape[2] = { 0, 0 };
+            for (int k = lo.z; k <= hi.z; k++)
+            {
+                for (int j = lo.y; j <= hi.y; j++)
+                {
+                    const unsigned char* row = texels + ((size_t)dim * dim * WrapIndex(k, dim) + (size_t)dim * WrapIndex(j, dim)) * channels;
+                    for (int i = lo.x; i <= hi.x; i++)
+                    {
+                        const unsigned char* texel = row + (size_t)WrapIndex(i, dim) * channels;
+                        maxShape[0] = std::max(maxShape[0], texel[0]);
+                        if (channels > 1) maxShape[1] = std::max(maxShape[1], texel[1]); // A missing g reads as 0
+                    }
+                }
+            }
+            return std::pow(maxShape[0] / 255.0f * (maxShape[1] / 255.0f), 0.3f);
+        });
+    }
+    MaxDensityGrid(const DensityVolume& density, ThreadPool* pool)
+    {
+        // Baked density: filtering never exceeds the largest texel, so the bound is tight
+        const int dim = density.GetResolution();
+        Build(dim, "baked density", pool, [&](glm::ivec3 lo, glm::ivec3 hi)
+        {
+            float maxDensity = 0.0f;
+            for (int k = lo.z; k <= hi.z; k++)
+            {
+                for (int j = lo.y; j <= hi.y; j++)
+                {
+                    for (int i = lo.x; i <= hi.x; i++)
+                    {
+                        maxDensity = std::max(maxDensity, density.Texel(WrapIndex(i, dim), WrapIndex(j, dim), WrapIndex(k, dim)));
+                    }
+                }
+            }
+            return maxDensity;
+        });
+    }
+    MaxDensityGrid(int dim, const std::vector<glm::vec2>& cellMaxima, bool rawNoise, bool halfFloat, ThreadPool* pool)
+    {
+        // Largest texels of every cell and its halo, reduced on the GPU by VolumeReduction: r and g of the shape
+        // noise or the baked density in r. 8 bit texels are rounded back to their bytes, so the bounds are the
+        // ones the constructors above find on the host.
+        const int cellCount = std::max(dim / CellTexels, 1);
+        const int cellTexels = dim / cellCount;
+        auto texel = [&](float value) { return halfFloat ? value : std::round(value * 255.0f) / 255.0f; };
+        Build(dim, rawNoise ? "shape noise reduced on the GPU" : "baked density reduced on the GPU", pool, [&](glm::ivec3 lo, glm::ivec3 hi)
+        {
+            (void)hi;
+            // Vector divisor, this GLM divides integer vectors by a scalar through a truncated reciprocal
+            glm::ivec3 cell = (lo + 1) / glm::ivec3(cellTexels);
+            glm::vec2 maxima = cellMaxima[(size_t)cellCount * cellCount * cell.z + (size_t)cellCount * cell.y + cell.x];
+            if (rawNoise) return std::pow(texel(maxima.x) * texel(maxima.y), 0.3f);
+            return texel(maxima.x);
+        });
+    }
+    int GetResolution() const { return resolution; }
+    const unsigned char* GetCells() const { return cells.data(); }
+
+    bool ActiveBounds(glm::vec3 boxMin, glm::vec3 boxMax, glm::vec3 offset, float cloudScale, glm::vec3& activeMin, glm::vec3& activeMax) const
+    {
+        // Tightest box inside the world space box [boxMin, boxMax] holding every occupied cell it reaches,
+        // found per axis from the first and last occupied slab. False when the box holds no density at all.
+        const float cellSize = 1.0f / (cloudScale * resolution);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            int first = (int)std::floor((boxMin[axis] + offset[axis]) / cellSize);
+            int last = (int)std::floor((boxMax[axis] + offset[axis]) / cellSize);
+            int lo = first, hi = last;
+            while (lo <= last && lo - first < resolution && !occupiedSlabs[axis][WrapIndex(lo, resolution)]) lo++;
+            if (lo > last || lo - first == resolution) return false;
+            while (!occupiedSlabs[axis][WrapIndex(hi, resolution)]) hi--;
+
+            activeMin[axis] = std::max(boxMin[axis], lo * cellSize - offset[axis]);
+            activeMax[axis] = std::min(boxMax[axis], (hi + 1) * cellSize - offset[axis]);
+        }
+        return true;
+    }
+};
+class DistanceField
+{
+    // Distance from every texel of the baked density to the nearest texel over the threshold, for sphere
+    // tracing. Exact Euclidean distance transform done as three separable 1D passes (Felzenszwalb and
+    // Huttenlocher) over lines three periods long, so distances wrap like the noise does.
+private:
+    int resolution;
+    std::vector<float> squared;        // Squared distances in texels while the passes run
+    std::vector<unsigned short> r16f;  // Safe radius in texels
+
+    static void Transform1D(const float* f, int n, float* d, int* v, float* z)
+    {
+        // Lower envelope of the parabolas rooted at (q, f[q]), sampled at every q
+        const float infinity = 1e20f;
+        int k = 0;
+        v[0] = 0;
+        z[0] = -infinity;
+        z[1] = infinity;
+        for (int q = 1; q < n; q++)
+        {
+            float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+            while (s <= z[k])
+            {
+                k--;
+                s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+            }
+            k++;
+            v[k] = q;
+            z[k] = s;
+            z[k + 1] = infinity;
+        }
+        k = 0;
+        for (int q = 0; q < n; q++)
+        {
+            while (z[k + 1] < q) k++;
+            d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+        }
+    }
+    void TransformAxis(int axis, ThreadPool* pool)
+    {
+        // Every line along axis, one slab of lines per task
+        const int dim = resolution;
+        const size_t stride[3] = { 1, (size_t)dim, (size_t)dim * dim };
+        const size_t lineStride = stride[axis];
+        const size_t rowStride = stride[axis == 0 ? 1 : 0];
+        const size_t slabStride = stride[axis == 2 ? 1 : 2];
+        ParallelFor(pool, dim, [&](int slab)
+        {
+            std::vector<float> f(3 * dim), d(3 * dim), z(3 * dim + 1);
+            std::vector<int> v(3 * dim);
+            for (int row = 0; row < dim; row++)
+            {
+                float* line = squared.data() + slab * slabStride + row * rowStride;
+                for (int q = 0; q < 3 * dim; q++) f[q] = line[(q % dim) * lineStride];
+                Transform1D(f.data(), 3 * dim, d.data(), v.data(), z.data());
+                for (int q = 0; q < dim; q++) line[q * lineStride] = d[dim + q];
+            }
+        });
+    }
+
+    template<typename Occupied>
+    void Build(ThreadPool* pool, Occupied occupied)
+    {
+        // occupied(i, j, k) says whether the texel is over the threshold
+        const int dim = resolution;
+        size_t count = (size_t)dim * dim * dim;
+        squared.resize(count);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        ParallelFor(pool, dim, [&](int k)
+        {
+            for (int j = 0; j < dim; j++)
+            {
+                for (int i = 0; i < dim; i++)
+                {
+                    squared[(size_t)dim * dim * k + (size_t)dim * j + i] = occupied(i, j, k) ? 0.0f : 1e20f;
+                }
+            }
+        });
+        for (int axis = 0; axis < 3; axis++) TransformAxis(axis, pool);
+
+        // A sample is nonzero only if a corner of its filtering cell is over the threshold, at most sqrt(3)
+        // texels away, and the texel read covers points up to sqrt(3) / 2 away from its centre
+        const float margin = 1.5f * std::sqrt(3.0f);
+        const float farthest = (float)dim; // Past every point of a period, when nothing is over the threshold
+        r16f.resize(count);
+        ParallelFor(pool, dim, [&](int k)
+        {
+            for (size_t voxel = (size_t)dim * dim * k; voxel < (size_t)dim * dim * (k + 1); voxel++)
+            {
+                r16f[voxel] = glm::packHalf1x16(glm::clamp(std::sqrt(squared[voxel]) - margin, 0.0f, farthest));
+            }
+        });
+        squared.clear();
+        squared.shrink_to_fit();
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Distance field " << dim << "x" << dim << "x" << dim << " built in "
+            << std::chrono::duration<float, std::milli>(end - start).count() << " ms" << std::endl;
+    }
+
+public:
+    DistanceField(const DensityVolume& density, ThreadPool* pool)
+        : resolution(density.GetResolution())
+    {
+        Build(pool, [&](int i, int j, int k) { return density.Texel(i, j, k) >= DensityThreshold; });
+    }
+    DistanceField(int dim, const std::vector<unsigned int>& occupancy, ThreadPool* pool)
+        : resolution(dim)
+    {
+        // Threshold bits packed on the GPU by VolumeReduction, one per texel with x fastest
+        Build(pool, [&](int i, int j, int k)
+        {
+            size_t voxel = (size_t)dim * dim * k + (size_t)dim * j + i;
+            return ((occupancy[voxel / 32] >> (voxel % 32)) & 1) != 0;
+        });
+    }
+    int GetResolution() const { return resolution; }
+    const unsigned short* GetData() const { return r16f.data(); }
+};
+float MipTexelToFloat(unsigned char texel) { return texel / 255.0f; }
+float MipTexelToFloat(unsigned short texel) { return glm::unpackHalf1x16(texel); }
+void MipTexelFromFloat(float value, unsigned char& texel) { texel = (unsigned char)(glm::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f); }
+void MipTexelFromFloat(float value, unsigned short& texel) { texel = glm::packHalf1x16(value); }
+
+template<typename T>
+std::vector<std::vector<T>> BuildMipChain(const T* texels, int dim, int channels, ThreadPool* pool)
+{
+    // Box filtered levels 1 ... n of a cubic volume, each texel the mean of its 2x2x2 parent texels.
+    // Halving an even, tileable volume never straddles the wrap, so every level tiles as well.
+    std::vector<std::vector<T>> levels;
+    const T* parent = texels;
+    int parentDim = dim;
+    while (parentDim > 1 && parentDim % 2 == 0)
+    {
+        int levelDim = parentDim / 2;
+        levels.push_back(std::vector<T>((size_t)levelDim * levelDim * levelDim * channels));
+        T* level = levels.back().data();
+
+        ParallelFor(pool, levelDim, [&](int k)
+        {
+            for (int j = 0; j < levelDim; j++)
+            {
+                for (int i = 0; i < levelDim; i++)
+                {
+                    for (int channel = 0; channel < channels; channel++)
+                    {
+                        float sum = 0.0f;
+                        for (int corner = 0; corner < 8; corner++)
+                        {
+                            size_t x = 2 * i + (corner & 1), y = 2 * j + ((corner >> 1) & 1), z = 2 * k + (corner >> 2);
+                            sum += MipTexelToFloat(parent[((z * parentDim + y) * parentDim + x) * channels + channel]);
+                        }
+                        MipTexelFromFloat(sum * 0.125f, level[(((size_t)k * levelDim + j) * levelDim + i) * channels + channel]);
+                    }
+                }
+            }
+        });
+
+        parent = level;
+        parentDim = levelDim;
+    }
+    return levels;
+}
+
+typedef struct
+{
+    int dim;                                         // Size of level 0 along each side
+    GLenum internalFormat, format, type;
+    int bytesPerTexel;
+    std::vector<std::vector<unsigned char>> levels;  // Level 0 first, each level half the size of the one before
+}VolumeLevels;
+
+template<typename T>
+VolumeLevels MakeVolumeLevels(const T* texels, int dim, int channels, GLenum internalFormat, GLenum format, GLenum type, ThreadPool* pool)
+{
+    VolumeLevels volume;
+    volume.dim = dim;
+    volume.internalFormat = internalFormat;
+    volume.format = format;
+    volume.type = type;
+    volume.bytesPerTexel = channels * sizeof(T);
+
+    size_t bytes = (size_t)dim * dim * dim * volume.bytesPerTexel;
+    volume.levels.push_back(std::vector<unsigned char>((const unsigned char*)texels, (const unsigned char*)texels + bytes));
+
+    std::vector<std::vector<T>> chain = BuildMipChain(texels, dim, channels, pool);
+    for (size_t i = 0; i < chain.size(); i++)
+    {
+        const unsigned char* level = (const unsigned char*)chain[i].data();
+        volume.levels.push_back(std::vector<unsigned char>(level, level + chain[i].size() * sizeof(T)));
+    }
+    return volume;
+}
+VolumeLevels NoiseVolumeLevels(const NoiseVolume& volume, ThreadPool* pool)
+{
+    const GLenum internalFormats[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+    const GLenum formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    const NoiseSettings& settings = volume.GetSettings();
+    return MakeVolumeLevels(volume.GetTexels(), settings.resolution, settings.channels,
+        internalFormats[settings.channels - 1], formats[settings.channels - 1], GL_UNSIGNED_BYTE, pool);
+}
+VolumeLevels DensityVolumeLevels(const DensityVolume& density, ThreadPool* pool)
+{
+    if (density.IsHalfFloat())
+        return MakeVolumeLevels((const unsigned short*)density.GetData(), density.GetResolution(), 1, GL_R16F, GL_RED, GL_HALF_FLOAT, pool);
+    return MakeVolumeLevels((const unsigned char*)density.GetData(), density.GetResolution(), 1, GL_R8, GL_RED, GL_UNSIGNED_BYTE, pool);
+}
+
+class VertexBuffer
+{
+private:
+    unsigned int ID;
+public:
+    VertexBuffer(const void* data, unsigned int size)
+    {
+        // Initialize Vextex Buffer
+        GLCall(glGenBuffers(1, &ID));
+        GLCall(glBindBuffer(GL_ARRAY_BUFFER, ID));
+        GLCall(glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW));
+    }
+    ~VertexBuffer()
+    {
+        // Delete VBO
+        GLCall(glDeleteBuffers(1, &ID));
+    }
+    void Bind()
+    {
+        // Bind/Use VBO
+        GLCall(glBindBuffer(GL_ARRAY_BUFFER, ID));
+    }
+    void Unbind()
+    {
+        // Unbind VBO
+        GLCall(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    }
+    void SubData(float* data, unsigned int size)
+    {
+        // Substitute VBO data
+        Bind();
+        GLCall(glBufferSubData(GL_ARRAY_BUFFER, 0, size, (const void*)data));
+        Unbind();
+    }
+    unsigned int GetID()
+    {
+        return ID;
+    }
+};
+class IndexBuffer
+{
+private:
+    unsigned int ID;
+    unsigned int Count;
+public:
+    IndexBuffer(const unsigned int* data, unsigned int count)
+    {
+        // No. of indices to draw
+        Count = count;
+
+        // Initialize IBO
+        GLCall(glGenBuffers(1, &ID));
+        GLCall(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ID));
+        GLCall(glBufferData(GL_ELEMENT_ARRAY_BUFFER, Count * sizeof(unsigned int), data, GL_STATIC_DRAW));
+    }
+    ~IndexBuffer()
+    {
+        // Delete IBO
+        GLCall(glDeleteBuffers(1, &ID));
+    }
+    void Bind()
+    {
+        // Bind/Use IBO
+        GLCall(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ID));
+    }
+    void Unbind()
+    {
+        // Unbind IBO
+        GLCall(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+    }
+    unsigned int GetID()
+    {
+        return ID;
+    }
+    unsigned int GetCount()
+    {
+        return Count;
+    }
+    void SubData(unsigned int* data, unsigned int count)
+    {
+        // Substitute IBO data
+        Bind();
+        GLCall(glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, count * sizeof(unsigned int), data));
+        Unbind();
+    }
+
+};
+typedef struct
+{
+    unsigned int type;
+    unsigned int count;
+    unsigned char normalized;
+    unsigned int typeSize;
+}LayoutElement;
+class VertexBufferLayout
+{
+private:
+    std::vector<LayoutElement> Elements;
+    unsigned int layoutSize;
+public:
+    VertexBufferLayout()
+    {
+        layoutSize = 0;
+    }
+
+    template<typename T>
+    void Push(unsigned int count)
+    {
+        /*static_assert(false);*/
+    }
+
+    template <>
+    void Push<float>(unsigned int count)
+    {
+        Elements.push_back({ GL_FLOAT, count, GL_FALSE, sizeof(float) });
+        layoutSize += count * sizeof(float);
+    }
+
+    template <>
+    void Push<int>(unsigned int count)
+    {
+        Elements.push_back({ GL_INT, count, GL_FALSE, sizeof(int) });
+        layoutSize += count * sizeof(unsigned int);
+    }
+
+    template <>
+    void Push<unsigned int>(unsigned int count)
+    {
+        Elements.push_back({ GL_UNSIGNED_INT, count, GL_FALSE, sizeof(unsigned int) });
+        layoutSize += count * sizeof(int);
+    }
+
+    std::vector<LayoutElement> GetElements()
+    {
+        return Elements;
+    }
+
+    unsigned int GetStride()
+    {
+        return layoutSize;
+    }
+};
+class VertexArray
+{
+private:
+    unsigned int ID;
+public:
+    VertexArray()
+    {
+        // Initialize VAO
+        GLCall(glGenVertexArrays(1, &ID));
+    }
+    ~VertexArray()
+    {
+        // Delete VAO
+        GLCall(glDeleteVertexArrays(1, &ID));
+    }
+    void AddBuffer(VertexBuffer* VBO, VertexBufferLayout* VBL)
+    {
+        // Use VAO and VBO
+        Bind();
+        VBO->Bind();
+
+        // Assign Layout to VAO
+        std::vector<LayoutElement> elements = VBL->GetElements();
+        unsigned int offSet = 0;
+        for (unsigned int i = 0; i < elements.size(); i++)
+        {
+            LayoutElement element = elements[i];
+            GLCall(glEnableVertexAttribArray(i));
+            GLCall(glVertexAttribPointer(i, element.count, element.type, element.normalized, VBL->GetStride(), (const void*)offSet));
+            offSet += element.count * element.typeSize;
+        }
+
+
+    }
+    void Bind()
+    {
+        // Bind/Use VAO
+        GLCall(glBindVertexArray(ID));
+    }
+    void Unbind()
+    {
+        // Unbind VAO
+        GLCall(glBindVertexArray(0));
+    }
+    unsigned int GetID()
+    {
+        return ID;
+    }
+};
+class Shader
+{
+private:
+    unsigned int ID;
+    std::string filePath;
+    std::unordered_map<std::string, int> uniformLocationCache;
+
+    static std::vector<std::string> ParseShader(const std::string& filepath, const std::vector<std::string>& defines)
+    {
+        std::ifstream stream(filepath);
+        std::string line;
+        std::stringstream ss[3];
+
+        int NONE = -1, VERTEX = 0, FRAGMENT = 1, COMPUTE = 2;
+
+        int shaderType = NONE;
+
+        if (stream.is_open())
+        {
+            while (getline(stream, line))
+            {
+                if (line.find("#shader") != std::string::npos)
+                {
+                    if (line.find("vertex") != std::string::npos) shaderType = VERTEX;
+                    else if (line.find("fragment") != std::string::npos) shaderType = FRAGMENT;
+                    else if (line.find("compute") != std::string::npos) shaderType = COMPUTE;
+
+                }
+                else if (shaderType != NONE && line.find("#include") == 0)
+                {
+                    // Shared functions, pasted in from a file in the same directory
+                    size_t open = line.find('"'), close = line.rfind('"');
+                    std::string includePath = filepath.substr(0, filepath.find_last_of("/\\") + 1) + line.substr(open + 1, close - open - 1);
+                    std::ifstream included(includePath);
+                    if (included.is_open()) ss[shaderType] << included.rdbuf() << "\n";
+                    else std::cout << "Failed to open File: " << includePath << std::endl;
+                }
+                else
+                {
+                    if (shaderType != NONE) ss[shaderType] << line << "\n";
+
+                    // Compile time variants go right after the version line of each stage
+                    if (shaderType != NONE && line.find("#version") != std::string::npos)
+                    {
+                        for (size_t i = 0; i < defines.size(); i++) ss[shaderType] << "#define " << defines[i] << "\n";
+                    }
+                }
+            }
+        }
+        else
+        {
+            std::cout << "Failed to open File: " << filepath << std::endl;
+        }
+
+
+        std::vector<std::string> shaders = { ss[0].str(), ss[1].str(), ss[2].str() };
+        return shaders;
+    }
+    static unsigned int CompileShader(unsigned int type, const std::string& source)
+    {
+        unsigned int id = glCreateShader(type);
+        const char* src = source.c_str();
+        GLCall(glShaderSource(id, 1, &src, nullptr));
+        GLCall(glCompileShader(id));
+
+        // Error Handling for Shader Compilation
+        int result;
+        GLCall(glGetShaderiv(id, GL_COMPILE_STATUS, &result)); // i: int, v: vector (array)
+        if (result == GL_FALSE)
+        {
+            int length;
+            GLCall(glGetShaderiv(id, GL_INFO_LOG_LENGTH, &length));
+            char* message = (char*)malloc(length * sizeof(char));
+            GLCall(glGetShaderInfoLog(id, length, &length, message));
+            std::cout << "Failed to Compile " << (type == GL_VERTEX_SHADER ? "vertex" : type == GL_FRAGMENT_SHADER ? "fragment" : "compute") << "Shader" << std::endl;
+            std::cout << message << std::endl;
+            GLCall(glDeleteShader(id));
+            free(message);
+            return 0;
+        }
+
+        return id;
+    }
+    static unsigned int CreateShader(const std::string& vertexShader, const std::string& fragmentShader)
+    {
+        unsigned int program = glCreateProgram();
+        unsigned int vs = CompileShader(GL_VERTEX_SHADER, vertexShader);
+        unsigned int fs = CompileShader(GL_FRAGMENT_SHADER, fragmentShader);
+
+        glAttachShader(program, vs);
+        glAttachShader(program, fs);
+        glLinkProgram(program);
+        glValidateProgram(program);
+
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+
+        return program;
+    }
+    static unsigned int CreateComputeShader(const std::string& computeShader)
+    {
+        unsigned int program = glCreateProgram();
+        unsigned int cs = CompileShader(GL_COMPUTE_SHADER, computeShader);
+
+        glAttachShader(program, cs);
+        glLinkProgram(program);
+        glValidateProgram(program);
+
+        glDeleteShader(cs);
+
+        return program;
+    }
+    int GetUniformLocation(const std::string& name)
+    {
+        if (uniformLocationCache.find(name) != uniformLocationCache.end())
+            return uniformLocationCache[name];
+
+        GLCall(int loc = glGetUniformLocation(ID, name.c_str()));
+        if (loc == -1) std::cerr << "Warning: uniform  " << name << "doesn't exist" << std::endl;
+
+        uniformLocationCache[name] = loc;
+        return loc;
+    }
+
+public:
+    Shader(const std::string& filepath, const std::vector<std::string>& defines = std::vector<std::string>())
+        : ID(0), filePath(filepath)
+    {
+        Compile(defines);
+    }
+    void Compile(const std::vector<std::string>& defines)
+    {
+        // (Re)builds the program with the given defines, uniform locations are looked up again
+        if (ID)
+        {
+            GLCall(glDeleteProgram(ID));
+        }
+        uniformLocationCache.clear();
+
+        std::vector<std::string> shaders = ParseShader(filePath, defines);
+        std::string vertexShader = shaders[0];
+        std::string fragmentShader = shaders[1];
+        std::string computeShader = shaders[2];
+
+        // A file with a compute section is a compute program, which needs a 4.3 context
+        if (!computeShader.empty()) ID = CreateComputeShader(computeShader);
+        else ID = CreateShader(vertexShader, fragmentShader);
+    }
+    ~Shader()
+    {
+        GLCall(glDeleteProgram(ID)); // Delete the shader
+    }
+
+    void Bind()
+    {
+        GLCall(glUseProgram(ID)); // Bind the shader
+    }
+    void Unbind()
+    {
+        GLCall(glUseProgram(0)); // Unbind the shader
+    }
+
+    void SetUniform4f(const std::string& name, float v0, float v1, float v2, float v3)
+    {
+        GLCall(glUniform4f(GetUniformLocation(name), v0, v1, v2, v3));
+    }
+    void SetUniform3f(const std::string& name, float v0, float v1, float v2)
+    {
+        GLCall(glUniform3f(GetUniformLocation(name), v0, v1, v2));
+    }
+    void SetUniform2f(const std::string& name, float v0, float v1)
+    {
+        GLCall(glUniform2f(GetUniformLocation(name), v0, v1));
+    }
+    void SetUniform1f(const std::string& name, float v0)
+    {
+        GLCall(glUniform1f(GetUniformLocation(name), v0));
+    }
+    void SetUniform1i(const std::string& name, int v0)
+    {
+        GLCall(glUniform1i(GetUniformLocation(name), v0));
+    }
+    void SetUniform2i(const std::string& name, int v0, int v1)
+    {
+        GLCall(glUniform2i(GetUniformLocation(name), v0, v1));
+    }
+    void SetUniform4i(const std::string& name, int v0, int v1, int v2, int v3)
+    {
+        GLCall(glUniform4i(GetUniformLocation(name), v0, v1, v2, v3));
+    }
+    void SetUniformMatrix4fv(const std::string& name, const GLfloat* v)
+    {
+        /*glUniformMatrix4fv(GetUniformLocation(name), 1, GL_FALSE, );*/
+        GLCall(glUniformMatrix4fv(GetUniformLocation(name), 1, GL_FALSE, v));
+    }
+
+};
+typedef struct {
+    unsigned int TextureID;  // ID handle of the glyph texture
+    glm::ivec2   Size;       // Size of glyph
+    glm::ivec2   Bearing;    // Offset from baseline to left/top of glyph
+    unsigned int Advance;    // Offset to advance to next glyph
+}TextChar;
+class Texture
+{
+private:
+    unsigned int textureID;
+    std::string filePath;
+    bool Dim3;
+    int height, width, bitsPerPixel;
+
+public:
+    Texture(const std::string& path)
+        : textureID(0), filePath(path), Dim3(false), height(0), width(0), bitsPerPixel(0)
+    {
+        glGenTextures(1, &textureID);
+        stbi_set_flip_vertically_on_load(1);
+        unsigned char* localBuffer = stbi_load(filePath.c_str(), &width, &height, &bitsPerPixel, 4);
+
+        // std::cout << filePath << " " << width << ", " << height << ", " << bitsPerPixel << std::endl;
+        if (!localBuffer) {
+            std::cerr << "Failed to load texture: " << filePath << std::endl;
+            return;
+        }
+
+        
+        glBindTexture(GL_TEXTURE_2D, textureID);
+
+        // Set texture parameters
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, localBuffer);
+        stbi_image_free(localBuffer);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    Texture(const VolumeLevels& volume)
+        : textureID(0), filePath(""), Dim3(true), height(0), width(0), bitsPerPixel(0)
+    {
+        std::vector<const void*> levels;
+        for (size_t i = 0; i < volume.levels.size(); i++) levels.push_back((const void*)volume.levels[i].data());
+        Create3D(volume.dim, volume.internalFormat, volume.format, volume.type, levels);
+    }
+    Texture(int size, int depth, GLenum internalFormat, GLenum format, GLenum type, GLenum filter, GLenum wrap, const void* texels)
+        : textureID(0), filePath(""), Dim3(true), height(size), width(size), bitsPerPixel(0)
+    {
+        // size x size x depth volume without mips, for lookup tables and render targets
+        glGenTextures(1, &textureID);
+        GLCall(glBindTexture(GL_TEXTURE_3D, textureID));
+        GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, wrap));
+        GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, wrap));
+        GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, wrap));
+        GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter));
+        GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter));
+        GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0));
+        GLCall(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+        GLCall(glTexImage3D(GL_TEXTURE_3D, 0, internalFormat, size, size, depth, 0, format, type, texels));
+        GLCall(glBindTexture(GL_TEXTURE_3D, 0));
+    }
+    Texture(int dim, GLenum internalFormat, GLenum format, GLenum type, int levelCount)
+        : textureID(0), filePath(""), Dim3(true), height(0), width(0), bitsPerPixel(0)
+    {
+        // Storage only, filled later with SubImage3D
+        Create3D(dim, internalFormat, format, type, std::vector<const void*>(levelCount, nullptr));
+    }
+    unsigned int GetID() const
+    {
+        return textureID;
+    }
+    void GenerateMipmaps()
+    {
+        // Box filters level 0 down on the GPU, for volumes written by compute shaders
+        GLCall(glBindTexture(GL_TEXTURE_3D, textureID));
+        GLCall(glGenerateMipmap(GL_TEXTURE_3D));
+        GLCall(glBindTexture(GL_TEXTURE_3D, 0));
+    }
+    void SetLevelRange(int baseLevel, int maxLevel)
+    {
+        // Mip levels that may be sampled, the others can be undefined
+        GLCall(glBindTexture(GL_TEXTURE_3D, textureID));
+        GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, baseLevel));
+        GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, maxLevel));
+        GLCall(glBindTexture(GL_TEXTURE_3D, 0));
+    }
+    void SubImage3D(int level, int zOffset, int dim, int depth, GLenum format, GLenum type, const void* data)
+    {
+        // data is an offset into the bound GL_PIXEL_UNPACK_BUFFER when one is bound
+        GLCall(glBindTexture(GL_TEXTURE_3D, textureID));
+        GLCall(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+        GLCall(glTexSubImage3D(GL_TEXTURE_3D, level, 0, 0, zOffset, dim, dim, depth, format, type, data));
+        GLCall(glBindTexture(GL_TEXTURE_3D, 0));
+    }
+    void GetImage(int level, GLenum format, GLenum type, void* data)
+    {
+        // Whole level back to the host, tightly packed
+        GLCall(glBindTexture(GL_TEXTURE_3D, textureID));
+        GLCall(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+        GLCall(glGetTexImage(GL_TEXTURE_3D, level, format, type, data));
+        GLCall(glBindTexture(GL_TEXTURE_3D, 0));
+    }
+private:
+    void Create3D(int dim, GLenum internalFormat, GLenum format, GLenum type, const std::vector<const void*>& levels)
+    {
+        // Create and bind a 3D texture
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_3D, textureID);
+
+        // Set texture parameters, trilinear between mip levels when there are any
+        GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT));
+        GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT));
+        GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT));
+        GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR));
+        GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+        GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, 0));
+        GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, (int)levels.size() - 1));
+
+        // Rows of 8 bit volumes with one to three channels are not 4 byte aligned
+        GLCall(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+        for (int level = 0; level < (int)levels.size(); level++)
+        {
+            int levelDim = std::max(dim >> level, 1);
+            GLCall(glTexImage3D(GL_TEXTURE_3D, level, internalFormat, levelDim, levelDim, levelDim, 0, format, type, levels[level]));
+        }
+
+        // Unbind the texture
+        GLCall(glBindTexture(GL_TEXTURE_3D, 0));
+    }
+public:
+    ~Texture()
+    {
+        glDeleteTextures(1, &textureID);
+    }
+    void Bind(unsigned int slot = 0)
+    {
+        glActiveTexture(GL_TEXTURE0 + slot);
+        if(Dim3) glBindTexture(GL_TEXTURE_3D, textureID);
+        else glBindTexture(GL_TEXTURE_2D, textureID);
+    }
+    void Unbind()
+    {
+        if (Dim3) glBindTexture(GL_TEXTURE_3D, 0);
+        else glBindTexture(GL_TEXTURE_2D, 0);
+        
+    }
+};
+class VolumeUpload
+{
+    // Streams the levels of a volume into a new texture a few z slices per frame through a pixel
+    // unpack buffer. The buffer is orphaned every step so the driver never stalls on the previous copy.
+private:
+    VolumeLevels volume;
+    Texture* texture;
+    unsigned int pbo;
+    int level, slice;
+
+public:
+    VolumeUpload(VolumeLevels& levels)
+        : texture(nullptr), pbo(0), level(0), slice(0)
+    {
+        volume.dim = levels.dim;
+        volume.internalFormat = levels.internalFormat;
+        volume.format = levels.format;
+        volume.type = levels.type;
+        volume.bytesPerTexel = levels.bytesPerTexel;
+        volume.levels.swap(levels.levels);
+
+        texture = new Texture(volume.dim, volume.internalFormat, volume.format, volume.type, (int)volume.levels.size());
+        GLCall(glGenBuffers(1, &pbo));
+    }
+    ~VolumeUpload()
+    {
+        delete texture;
+        GLCall(glDeleteBuffers(1, &pbo));
+    }
+    bool IsDone() const { return level >= (int)volume.levels.size(); }
+    size_t Step(size_t byteBudget)
+    {
+        // Uploads whole slices until the budget is spent, at least one slice per call. Returns the bytes sent.
+        if (IsDone()) return 0;
+
+        int levelDim = std::max(volume.dim >> level, 1);
+        size_t sliceBytes = (size_t)levelDim * levelDim * volume.bytesPerTexel;
+        int depth = (int)std::min<size_t>(std::max<size_t>(byteBudget / sliceBytes, 1), (size_t)(levelDim - slice));
+        size_t bytes = sliceBytes * depth;
+
+        GLCall(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo));
+        GLCall(glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW));
+        void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (mapped)
+        {
+            std::memcpy(mapped, volume.levels[level].data() + sliceBytes * slice, bytes);
+            GLCall(glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER));
+            texture->SubImage3D(level, slice, levelDim, depth, volume.format, volume.type, (const void*)0);
+        }
+        else
+        {
+            GLCall(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+            texture->SubImage3D(level, slice, levelDim, depth, volume.format, volume.type, volume.levels[level].data() + sliceBytes * slice);
+        }
+        GLCall(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+
+        slice += depth;
+        if (slice >= levelDim)
+        {
+            // Free each level as soon as it is on the GPU
+            std::vector<unsigned char>().swap(volume.levels[level]);
+            level++;
+            slice = 0;
+        }
+        return bytes;
+    }
+    Texture* Release()
+    {
+        Texture* released = texture;
+        texture = nullptr;
+        return released;
+    }
+};
+class NoiseSlabStream
+{
+    // Builds a noise texture a z slab at a time, the volume never exists on the host. A worker
+    // generates slabs into a small ring of quantized buffers and appends them to the noise cache,
+    // while the GL thread uploads filled slots with glTexSubImage3D and hands them back. A cached
+    // volume is uploaded straight from the mapped file. Host memory is the ring plus one slab of
+    // floats whatever the resolution; mips are built on the GPU once level 0 is complete.
+private:
+    NoiseSettings settings;
+    ThreadPool* pool;
+    NoiseGenerator* generator;
+    MappedFile* mapped;
+    Texture* texture;
+    GLenum format;
+    int slabDepth, numSlabs, nextUpload;
+    bool done;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable slotFilled, slotFreed;
+    std::vector<std::vector<unsigned char>> ring;
+    std::vector<int> ringSlab; // Slab held by each slot, -1 while the worker may fill it
+    bool cancelled;
+
+    size_t SlabBytes(int slab) const
+    {
+        int depth = std::min(slabDepth, settings.resolution - slab * slabDepth);
+        return (size_t)settings.resolution * settings.resolution * depth * settings.channels;
+    }
+    void Produce()
+    {
+        int dim = settings.resolution;
+        std::vector<float> scratch((size_t)dim * dim * slabDepth * 4);
+        float scale[4], bias[4];
+        generator->BeginSlabs(pool, slabDepth, scratch.data(), scale, bias);
+
+        NoiseCache cache("resources/cache");
+        CacheFile* file = cache.BeginStore(settings, generator->GetVersion());
+
+        int slab;
+        for (slab = 0; slab < numSlabs; slab++)
+        {
+            int slot = slab % RingSize;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                slotFreed.wait(lock, [&] { return cancelled || ringSlab[slot] < 0; });
+                if (cancelled) break;
+            }
+
+            int startZ = slab * slabDepth;
+            generator->GenerateSlabTexels(pool, startZ, std::min(startZ + slabDepth, dim), scratch.data(), scale, bias, ring[slot].data());
+            if (file) file->Write(ring[slot].data(), SlabBytes(slab));
+
+            std::lock_guard<std::mutex> lock(mutex);
+            ringSlab[slot] = slab;
+            slotFilled.notify_all();
+        }
+
+        if (file) cache.EndStore(file, slab == numSlabs);
+    }
+
+public:
+    static const int RingSize = 3;
+    static const size_t ScratchBytes = 16 << 20;     // Floats of one slab
+    static const size_t StreamThreshold = 64 << 20; // Volumes above this are streamed
+
+    static bool Streamed(const NoiseSettings& settings)
+    {
+        return NoiseVolumeBytes(settings) > StreamThreshold;
+    }
+
+    NoiseSlabStream(const NoiseSettings& noiseSettings, ThreadPool* threadPool)
+        : settings(noiseSettings), pool(threadPool), generator(nullptr), mapped(nullptr), texture(nullptr),
+        nextUpload(0), done(false), cancelled(false)
+    {
+        int dim = settings.resolution;
+        slabDepth = (int)glm::clamp(ScratchBytes / ((size_t)dim * dim * 4 * sizeof(float)), (size_t)1, (size_t)dim);
+        numSlabs = (dim + slabDepth - 1) / slabDepth;
+
+        const GLenum internalFormats[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+        const GLenum formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+        format = formats[settings.channels - 1];
+        int levelCount = 1;
+        while ((dim >> levelCount) > 0) levelCount++;
+        texture = new Texture(dim, internalFormats[settings.channels - 1], format, GL_UNSIGNED_BYTE, levelCount);
+
+        generator = NoiseGenerator::Create(settings);
+        NoiseCache cache("resources/cache");
+        mapped = cache.Load(settings, generator->GetVersion());
+        if (mapped)
+        {
+            std::cout << generator->GetName() << " noise " << dim << "x" << dim << "x" << dim << " streamed from cache" << std::endl;
+            return;
+        }
+
+        for (int slot = 0; slot < RingSize; slot++)
+        {
+            ring.push_back(std::vector<unsigned char>(SlabBytes(0)));
+            ringSlab.push_back(-1);
+        }
+        std::cout << generator->GetName() << " noise " << dim << "x" << dim << "x" << dim << " streamed in " << numSlabs << " slabs of "
+            << slabDepth << ", host memory " << (RingSize * SlabBytes(0) + (size_t)dim * dim * slabDepth * 4 * sizeof(float)) / 1024
+            << " KiB instead of " << NoiseVolumeBytes(settings) / 1024 << " KiB" << std::endl;
+        worker = std::thread(&NoiseSlabStream::Produce, this);
+    }
+    ~NoiseSlabStream()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cancelled = true;
+        }
+        slotFreed.notify_all();
+        if (worker.joinable()) worker.join();
+        delete generator;
+        delete mapped;
+        delete texture;
+    }
+    bool IsDone() const { return done; }
+    size_t Step(size_t byteBudget, bool wait)
+    {
+        // Uploads finished slabs in z order until the budget is spent, blocking for the next one
+        // only when wait is set. Returns the bytes sent, the mips are built after the last slab.
+        size_t sent = 0;
+        while (!done && nextUpload < numSlabs && sent < byteBudget)
+        {
+            const unsigned char* texels;
+            int slot = nextUpload % RingSize;
+            if (mapped)
+            {
+                texels = mapped->GetData() + sizeof(NoiseCacheHeader) + SlabBytes(0) * nextUpload;
+            }
+            else
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (wait) slotFilled.wait(lock, [&] { return ringSlab[slot] == nextUpload; });
+                else if (ringSlab[slot] != nextUpload) break;
+                texels = ring[slot].data();
+            }
+
+            int startZ = nextUpload * slabDepth;
+            int depth = std::min(slabDepth, settings.resolution - startZ);
+            texture->SubImage3D(0, startZ, settings.resolution, depth, format, GL_UNSIGNED_BYTE, texels);
+            sent += SlabBytes(nextUpload);
+
+            if (!mapped)
+            {
+                // glTexSubImage3D has copied the slab, the worker may refill the slot
+                std::lock_guard<std::mutex> lock(mutex);
+                ringSlab[slot] = -1;
+                slotFreed.notify_all();
+            }
+            nextUpload++;
+        }
+
+        if (!done && nextUpload == numSlabs)
+        {
+            texture->GenerateMipmaps();
+            if (worker.joinable()) worker.join();
+            done = true;
+        }
+        return sent;
+    }
+    Texture* Release()
+    {
+        Texture* released = texture;
+        texture = nullptr;
+        return released;
+    }
+};
+Texture* CreateNoiseTexture(const NoiseSettings& settings, NoiseVolume*& volume, ThreadPool* pool)
+{
+    // Small volumes keep their texels on the host for the CPU density bake, large ones are streamed
+    volume = nullptr;
+    if (!NoiseSlabStream::Streamed(settings))
+    {
+        volume = new NoiseVolume(settings, pool);
+        return new Texture(NoiseVolumeLevels(*volume, pool));
+    }
+
+    NoiseSlabStream stream(settings, pool);
+    while (!stream.IsDone()) stream.Step(std::numeric_limits<size_t>::max(), true);
+    return stream.Release();
+}
+class ProgressiveNoise
+{
+    // Startup upload that never blocks the first frame. A worker generates the volume coarse to fine,
+    // each mip level at its own resolution, writing quantized texels straight into a mapped pixel
+    // unpack buffer per level. Every frame the GL thread lowers the texture's base level to the finest
+    // complete level, so the clouds sharpen over the first frames. On GL 4.4 the buffers are
+    // persistently mapped and finished slabs are uploaded while the rest of the level is generated;
+    // older contexts keep a plain mapping open and upload each level once it is complete. A 4.4
+    // context always has compute shaders, so this only runs there for volumes ComputeNoise does not
+    // support: the other backends and three channel Worley. The finest level also goes to the noise
+    // cache and the previews are replaced by a box filtered chain at the end.
+private:
+    NoiseSettings settings;
+    ThreadPool* pool;
+    Texture* texture;
+    GLenum format;
+    int levelCount, firstLevel, nextLevel, uploadedSlices;
+    bool persistent;
+
+    std::thread worker;
+    std::atomic<int>* generatedSlices; // Slices of each level the worker has written
+    std::atomic<bool> cancelled;
+    std::vector<unsigned int> pbos;
+    std::vector<unsigned char*> mapped;
+
+    void Produce()
+    {
+        for (int level = firstLevel; level >= 0 && !cancelled; level--)
+        {
+            // The same field at a lower resolution, tileable at every level
+            NoiseSettings levelSettings = settings;
+            levelSettings.resolution = settings.resolution >> level;
+            NoiseGenerator* generator = NoiseGenerator::Create(levelSettings);
+
+            int dim = levelSettings.resolution;
+            int slabDepth = (int)glm::clamp(NoiseSlabStream::ScratchBytes / ((size_t)dim * dim * 4 * sizeof(float)), (size_t)1, (size_t)dim);
+            std::vector<float> scratch((size_t)dim * dim * slabDepth * 4);
+            float scale[4], bias[4];
+            generator->BeginSlabs(pool, slabDepth, scratch.data(), scale, bias);
+
+            NoiseCache cache("resources/cache");
+            CacheFile* file = level == 0 ? cache.BeginStore(settings, generator->GetVersion()) : nullptr;
+
+            // Each slab is quantized straight into the mapping, which is never read back. The cache gets
+            // the same texels through a slab sized host buffer.
+            size_t sliceBytes = (size_t)dim * dim * settings.channels;
+            std::vector<unsigned char> cached(file ? sliceBytes * slabDepth : 0);
+            for (int startZ = 0; startZ < dim && !cancelled; startZ += slabDepth)
+            {
+                int endZ = std::min(startZ + slabDepth, dim);
+                generator->GenerateSlabTexels(pool, startZ, endZ, scratch.data(), scale, bias, mapped[level] + sliceBytes * startZ, file ? cached.data() : nullptr);
+                if (file) file->Write(cached.data(), sliceBytes * (endZ - startZ));
+                generatedSlices[level] = endZ;
+            }
+            if (file) cache.EndStore(file, !cancelled);
+            delete generator;
+        }
+    }
+
+public:
+    static const int PreviewResolution = 16;
+
+    ProgressiveNoise(const NoiseSettings& noiseSettings, ThreadPool* threadPool)
+        : settings(noiseSettings), pool(threadPool), texture(nullptr), uploadedSlices(0), generatedSlices(nullptr), cancelled(false)
+    {
+        int dim = settings.resolution;
+        const GLenum internalFormats[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+        const GLenum formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+        format = formats[settings.channels - 1];
+        levelCount = 1;
+        while ((dim >> levelCount) > 0) levelCount++;
+        firstLevel = 0;
+        while ((dim >> (firstLevel + 1)) >= PreviewResolution) firstLevel++;
+        nextLevel = firstLevel;
+        generatedSlices = new std::atomic<int>[firstLevel + 1];
+        for (int level = 0; level <= firstLevel; level++) generatedSlices[level] = 0;
+        texture = new Texture(dim, internalFormats[settings.channels - 1], format, GL_UNSIGNED_BYTE, levelCount);
+        texture->SetLevelRange(firstLevel, firstLevel);
+
+        // One buffer per level, mapped up front so the worker never needs the GL thread. The mappings
+        // are write only, on discrete GPUs they are uncached or write combined and slow to read.
+        persistent = glBufferStorage != nullptr;
+        pbos.resize(firstLevel + 1);
+        mapped.resize(firstLevel + 1);
+        GLCall(glGenBuffers((int)pbos.size(), pbos.data()));
+        for (int level = 0; level <= firstLevel; level++)
+        {
+            int levelDim = dim >> level;
+            size_t bytes = (size_t)levelDim * levelDim * levelDim * settings.channels;
+            GLCall(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[level]));
+            if (persistent)
+            {
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                GLCall(glBufferStorage(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, flags));
+                mapped[level] = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, flags);
+            }
+            else
+            {
+                GLCall(glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW));
+                mapped[level] = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            }
+        }
+        GLCall(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+
+        std::cout << NoiseGeneratorNames[settings.generator] << " noise " << dim << "x" << dim << "x" << dim << " generated progressively from "
+            << (dim >> firstLevel) << "^3 through " << (persistent ? "persistently " : "") << "mapped buffers" << std::endl;
+        worker = std::thread(&ProgressiveNoise::Produce, this);
+    }
+    ~ProgressiveNoise()
+    {
+        // The texture belongs to whoever samples it, only the buffers are freed here
+        cancelled = true;
+        if (worker.joinable()) worker.join();
+        for (int level = 0; level < (int)pbos.size(); level++)
+        {
+            if (!pbos[level]) continue;
+            GLCall(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[level]));
+            if (mapped[level]) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            GLCall(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+            GLCall(glDeleteBuffers(1, &pbos[level]));
+        }
+        delete[] generatedSlices;
+    }
+    static bool Cached(const NoiseSettings& settings)
+    {
+        NoiseGenerator* generator = NoiseGenerator::Create(settings);
+        MappedFile* file = NoiseCache("resources/cache").Load(settings, generator->GetVersion());
+        bool cached = file != nullptr;
+        delete file;
+        delete generator;
+        return cached;
+    }
+    Texture* GetTexture() { return texture; }
+    bool IsDone() const { return nextLevel < 0; }
+    bool Update()
+    {
+        // Called once per frame on the GL thread, uploads what the worker has written and true once all is in
+        while (nextLevel >= 0)
+        {
+            int levelDim = settings.resolution >> nextLevel;
+            int ready = generatedSlices[nextLevel];
+            if (ready == uploadedSlices || (!persistent && ready < levelDim)) break;
+
+            GLCall(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[nextLevel]));
+            if (!persistent)
+            {
+                GLCall(glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER));
+            }
+            size_t offset = (size_t)levelDim * levelDim * settings.channels * uploadedSlices;
+            texture->SubImage3D(nextLevel, uploadedSlices, levelDim, ready - uploadedSlices, format, GL_UNSIGNED_BYTE, (const void*)offset);
+            uploadedSlices = ready;
+
+            if (uploadedSlices == levelDim)
+            {
+                if (persistent)
+                {
+                    GLCall(glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER));
+                }
+                GLCall(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+                GLCall(glDeleteBuffers(1, &pbos[nextLevel]));
+                pbos[nextLevel] = 0;
+                mapped[nextLevel] = nullptr;
+                texture->SetLevelRange(nextLevel, nextLevel);
+
+                nextLevel--;
+                uploadedSlices = 0;
+            }
+            GLCall(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+        }
+
+        if (nextLevel < 0 && worker.joinable())
+        {
+            worker.join();
+            texture->SetLevelRange(0, levelCount - 1);
+            texture->GenerateMipmaps();
+        }
+        return nextLevel < 0;
+    }
+};
+class ComputeVolume
+{
+    // One volume written by a compute shader, dispatched a slab of z slices per Step() so no single frame
+    // waits on the whole volume. Worley noise builds its feature points, then runs the store pass over
+    // every slab; a density bake is a single pass. Mips are built after the last slab.
+private:
+    Shader* shader;
+    Texture* texture;
+    GLenum internalFormat;
+    int dim;
+    int pass, lastPass, slice;
+    NoiseSettings settings;       // Worley only
+    unsigned int rangeBuffer;     // Worley only, largest squared distance per channel, see WorleyRange
+    unsigned int pointBuffer;     // Worley only, padded feature point grid of every channel
+    Texture* shape;               // Bake only
+    Texture* detail;
+    float detailScale;
+
+    static int MipCount(int dim)
+    {
+        int levels = 1;
+        while (dim > 1 && dim % 2 == 0) { dim /= 2; levels++; }
+        return levels;
+    }
+    static GLuint Groups(int dim)
+    {
+        // Both kernels use 8x8x8 work groups
+        return (GLuint)((dim + 7) / 8);
+    }
+    void BindWorley()
+    {
+        GLCall(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, rangeBuffer));
+        GLCall(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, pointBuffer));
+        GLCall(glBindImageTexture(0, texture->GetID(), 0, GL_TRUE, 0, GL_WRITE_ONLY, internalFormat));
+        shader->Bind();
+        shader->SetUniform1i("noiseImage", 0);
+        shader->SetUniform1i("resolution", dim);
+        shader->SetUniform1i("channels", settings.channels);
+        shader->SetUniform4i("frequency", settings.frequency[0], settings.frequency[1], settings.frequency[2], settings.frequency[3]);
+        shader->SetUniform1i("seed", (int)settings.seed);
+    }
+    void BindBake()
     {
-        return Elements;
+        shape->Bind(0);
+        detail->Bind(1);
+        GLCall(glBindImageTexture(0, texture->GetID(), 0, GL_TRUE, 0, GL_WRITE_ONLY, internalFormat));
+        shader->Bind();
+        shader->SetUniform1i("shapeTexture", 0);
+        shader->SetUniform1i("detailTexture", 1);
+        shader->SetUniform1i("densityImage", 0);
+        shader->SetUniform1i("resolution", dim);
+        shader->SetUniform1f("detailScale", detailScale);
     }
 
-    unsigned int GetStride()
+public:
+    ComputeVolume(Shader* worleyShader, const NoiseSettings& noiseSettings)
+        : shader(worleyShader), dim(noiseSettings.resolution), pass(0), lastPass(1), slice(0), settings(noiseSettings),
+        shape(nullptr), detail(nullptr), detailScale(0.0f)
     {
-        return layoutSize;
+        const GLenum internalFormats[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+        const GLenum formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+        internalFormat = internalFormats[settings.channels - 1];
+        texture = new Texture(dim, internalFormat, formats[settings.channels - 1], GL_UNSIGNED_BYTE, MipCount(dim));
+
+        // The range is bounded from the same feature points as the CPU generator, so no pass over the
+        // volume reduces it. The points themselves are filled by pass 0.
+        float range[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        size_t points = 0;
+        for (int channel = 0; channel < settings.channels; channel++)
+        {
+            int padded = settings.frequency[channel] + 2;
+            points += (size_t)padded * padded * padded;
+            range[channel] = WorleyRange(FeaturePointGrid(settings.frequency[channel], Hash(settings.seed + channel)), dim, nullptr);
+        }
+        GLCall(glGenBuffers(1, &rangeBuffer));
+        GLCall(glGenBuffers(1, &pointBuffer));
+        GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, rangeBuffer));
+        GLCall(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(range), range, GL_STATIC_DRAW));
+        GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, pointBuffer));
+        GLCall(glBufferData(GL_SHADER_STORAGE_BUFFER, points * 4 * sizeof(float), nullptr, GL_DYNAMIC_COPY));
+        GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
     }
-};
-class VertexArray
-{
-private:
-    unsigned int ID;
-public:
-    VertexArray()
+    ComputeVolume(Shader* densityShader, Texture* shapeTexture, Texture* detailTexture, int resolution, float scale, bool halfFloat)
+        : shader(densityShader), dim(resolution), pass(1), lastPass(1), slice(0), rangeBuffer(0), pointBuffer(0),
+        shape(shapeTexture), detail(detailTexture), detailScale(scale)
     {
-        // Initialize VAO
-        GLCall(glGenVertexArrays(1, &ID));
+        // Same values as DensityVolume, read from shape and detail textures already on the GPU
+        internalFormat = halfFloat ? GL_R16F : GL_R8;
+        texture = new Texture(dim, internalFormat, GL_RED, halfFloat ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE, MipCount(dim));
     }
-    ~VertexArray()
+    ~ComputeVolume()
     {
-        // Delete VAO
-        GLCall(glDeleteVertexArrays(1, &ID));
+        delete texture;
+        if (rangeBuffer)
+        {
+            GLCall(glDeleteBuffers(1, &rangeBuffer));
+            GLCall(glDeleteBuffers(1, &pointBuffer));
+        }
     }
-    void AddBuffer(VertexBuffer* VBO, VertexBufferLayout* VBL)
+    bool IsDone() const { return pass > lastPass; }
+    Texture* GetTexture() const { return texture; }
+    size_t Step(size_t voxelBudget)
     {
-        // Use VAO and VBO
-        Bind();
-        VBO->Bind();
+        // Dispatches whole slabs of 8 slices until the budget is spent, at least one per call. Returns the
+        // voxels dispatched.
+        if (IsDone()) return 0;
 
-        // Assign Layout to VAO
-        std::vector<LayoutElement> elements = VBL->GetElements();
-        unsigned int offSet = 0;
-        for (unsigned int i = 0; i < elements.size(); i++)
+        if (rangeBuffer) BindWorley();
+        else BindBake();
+        if (pass == 0)
         {
-            LayoutElement element = elements[i];
-            GLCall(glEnableVertexAttribArray(i));
-            GLCall(glVertexAttribPointer(i, element.count, element.type, element.normalized, VBL->GetStride(), (const void*)offSet));
-            offSet += element.count * element.typeSize;
+            // One invocation per padded cell of the largest grid
+            int maxPadded = 0;
+            for (int channel = 0; channel < settings.channels; channel++) maxPadded = std::max(maxPadded, settings.frequency[channel] + 2);
+            shader->SetUniform1i("pass", 0);
+            shader->SetUniform1i("firstSlice", 0);
+            GLCall(glDispatchCompute(Groups(maxPadded), Groups(maxPadded), Groups(maxPadded)));
+            GLCall(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+            pass = 1;
         }
 
+        size_t sliceVoxels = (size_t)dim * dim;
+        int depth = (int)std::min<size_t>(std::max<size_t>(voxelBudget / sliceVoxels / 8, 1) * 8, (size_t)(dim - slice));
+        if (rangeBuffer) shader->SetUniform1i("pass", pass);
+        shader->SetUniform1i("firstSlice", slice);
+        GLCall(glDispatchCompute(Groups(dim), Groups(dim), Groups(depth)));
+        shader->Unbind();
 
+        slice += depth;
+        if (slice >= dim)
+        {
+            // The texture has to be complete before it is sampled
+            slice = 0;
+            pass++;
+            GLCall(glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
+            texture->GenerateMipmaps();
+        }
+        return sliceVoxels * depth;
     }
-    void Bind()
-    {
-        // Bind/Use VAO
-        GLCall(glBindVertexArray(ID));
-    }
-    void Unbind()
+    Texture* Finish()
     {
-        // Unbind VAO
-        GLCall(glBindVertexArray(0));
+        // Every remaining slab at once, then hands over the texture
+        while (!IsDone()) Step(std::numeric_limits<size_t>::max());
+        return Release();
     }
-    unsigned int GetID()
+    Texture* Release()
     {
-        return ID;
+        Texture* released = texture;
+        texture = nullptr;
+        return released;
     }
 };
-class Shader
+class VolumeReduction
 {
+    // The max density grid cells and threshold bits of a finished volume, reduced by a compute shader so
+    // only these buffers come back to the host rather than the volume. The dispatches are issued by the
+    // constructor; reading waits for them, so callers that must not stall read after a fence.
 private:
-    unsigned int ID;
-    std::unordered_map<std::string, int> uniformLocationCache;
+    int dim, cells;
+    unsigned int cellBuffer;
+    unsigned int occupancyBuffer; // Only when the threshold bits were asked for
 
-    static std::pair<std::string, std::string> ParseShader(const std::string& filepath)
+    template<typename T>
+    static std::vector<T> Read(unsigned int buffer, size_t count)
     {
-        std::ifstream stream(filepath);
-        std::string line;
-        std::stringstream ss[2];
-
-        int NONE = -1, VERTEX = 0, FRAGMENT = 1;
-
-        int shaderType = NONE;
+        std::vector<T> data(count);
+        GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer));
+        GLCall(glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(T), data.data()));
+        GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+        return data;
+    }
+    size_t OccupancyWords() const
+    {
+        return ((size_t)dim * dim * dim + 31) / 32;
+    }
 
-        if (stream.is_open())
+public:
+    VolumeReduction(Shader* shader, Texture* volume, int resolution, bool occupancy)
+        : dim(resolution), cells(std::max(resolution / MaxDensityGrid::CellTexels, 1)), occupancyBuffer(0)
+    {
+        size_t cellCount = (size_t)cells * cells * cells;
+        GLCall(glGenBuffers(1, &cellBuffer));
+        GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellBuffer));
+        GLCall(glBufferData(GL_SHADER_STORAGE_BUFFER, cellCount * sizeof(glm::vec2), nullptr, GL_STREAM_READ));
+        if (occupancy)
         {
-            while (getline(stream, line))
-            {
-                if (line.find("#shader") != std::string::npos)
-                {
-                    if (line.find("vertex") != std::string::npos) shaderType = VERTEX;
-                    else if (line.find("fragment") != std::string::npos) shaderType = FRAGMENT;
+            GLCall(glGenBuffers(1, &occupancyBuffer));
+            GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, occupancyBuffer));
+            GLCall(glBufferData(GL_SHADER_STORAGE_BUFFER, OccupancyWords() * sizeof(unsigned int), nullptr, GL_STREAM_READ));
+        }
+        GLCall(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
 
-                }
-                else
-                {
-                    if (shaderType != NONE) ss[shaderType] << line << "\n";
-                }
-            }
+        volume->Bind(0);
+        GLCall(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, cellBuffer));
+        if (occupancy)
+        {
+            GLCall(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, occupancyBuffer));
         }
-        else
+        shader->Bind();
+        shader->SetUniform1i("volume", 0);
+        shader->SetUniform1i("resolution", dim);
+        shader->SetUniform1i("cells", cells);
+        shader->SetUniform1f("threshold", DensityThreshold);
+        shader->SetUniform1i("pass", 0);
+        GLCall(glDispatchCompute((GLuint)((cellCount + 63) / 64), 1, 1));
+        if (occupancy)
         {
-            std::cout << "Failed to open File: " << filepath << std::endl;
+            shader->SetUniform1i("pass", 1);
+            GLCall(glDispatchCompute((GLuint)((OccupancyWords() + 63) / 64), 1, 1));
         }
-
-
-        std::pair<std::string, std::string> shaders = { ss[0].str(), ss[1].str() };
-        return shaders;
+        shader->Unbind();
+        GLCall(glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT));
     }
-    static unsigned int CompileShader(unsigned int type, const std::string& source)
+    ~VolumeReduction()
     {
-        unsigned int id = glCreateShader(type);
-        const char* src = source.c_str();
-        GLCall(glShaderSource(id, 1, &src, nullptr));
-        GLCall(glCompileShader(id));
-
-        // Error Handling for Shader Compilation
-        int result;
-        GLCall(glGetShaderiv(id, GL_COMPILE_STATUS, &result)); // i: int, v: vector (array)
-        if (result == GL_FALSE)
+        GLCall(glDeleteBuffers(1, &cellBuffer));
+        if (occupancyBuffer)
         {
-            int length;
-            GLCall(glGetShaderiv(id, GL_INFO_LOG_LENGTH, &length));
-            char* message = (char*)malloc(length * sizeof(char));
-            GLCall(glGetShaderInfoLog(id, length, &length, message));
-            std::cout << "Failed to Compile " << (type == GL_VERTEX_SHADER ? "vertex" : "fragment") << "Shader" << std::endl;
-            std::cout << message << std::endl;
-            GLCall(glDeleteShader(id));
-            free(message);
-            return 0;
+            GLCall(glDeleteBuffers(1, &occupancyBuffer));
         }
-
-        return id;
-    }
-    static unsigned int CreateShader(const std::string& vertexShader, const std::string& fragmentShader)
-    {
-        unsigned int program = glCreateProgram();
-        unsigned int vs = CompileShader(GL_VERTEX_SHADER, vertexShader);
-        unsigned int fs = CompileShader(GL_FRAGMENT_SHADER, fragmentShader);
-
-        glAttachShader(program, vs);
-        glAttachShader(program, fs);
-        glLinkProgram(program);
-        glValidateProgram(program);
-
-        glDeleteShader(vs);
-        glDeleteShader(fs);
-
-        return program;
-    }
-    int GetUniformLocation(const std::string& name)
-    {
-        if (uniformLocationCache.find(name) != uniformLocationCache.end())
-            return uniformLocationCache[name];
-
-        GLCall(int loc = glGetUniformLocation(ID, name.c_str()));
-        if (loc == -1) std::cerr << "Warning: uniform  " << name << "doesn't exist" << std::endl;
-
-        uniformLocationCache[name] = loc;
-        return loc;
     }
+    int GetResolution() const { return dim; }
+    std::vector<glm::vec2> ReadCellMaxima() const { return Read<glm::vec2>(cellBuffer, (size_t)cells * cells * cells); }
+    std::vector<unsigned int> ReadOccupancy() const { return Read<unsigned int>(occupancyBuffer, OccupancyWords()); }
+};
+class ComputeNoise
+{
+    // GL 4.3 path: Worley noise and the density bake run as compute shaders that imageStore
+    // straight into the textures, so nothing is generated, cached or copied on the host. Only
+    // the reductions the skipping structures are built from are read back.
+private:
+    Shader* worleyShader;
+    Shader* densityShader;
+    Shader* reduceShader;
 
 public:
-    Shader(const std::string& filepath)
+    ComputeNoise()
     {
-        std::pair<std::string, std::string> shaders = ParseShader(filepath);
-        std::string vertexShader = shaders.first;
-        std::string fragmentShader = shaders.second;
-
-        ID = CreateShader(vertexShader, fragmentShader);
+        worleyShader = new Shader("resources/shaders/worley_compute.glsl");
+        densityShader = new Shader("resources/shaders/density_compute.glsl");
+        reduceShader = new Shader("resources/shaders/reduce_compute.glsl");
     }
-    ~Shader()
+    ~ComputeNoise()
     {
-        GLCall(glDeleteProgram(ID)); // Delete the shader
+        delete worleyShader;
+        delete densityShader;
+        delete reduceShader;
     }
-
-    void Bind()
+    static bool Supports(const NoiseSettings& settings)
     {
-        GLCall(glUseProgram(ID)); // Bind the shader
+        // Only the Worley backend has a compute kernel, the rest stay on the CPU.
+        // There are no three channel image formats, RGB8 volumes are uploaded from the CPU.
+        return settings.generator == 0 && settings.channels != 3;
     }
-    void Unbind()
+    ComputeVolume* StartWorley(const NoiseSettings& settings)
     {
-        GLCall(glUseProgram(0)); // Unbind the shader
+        return new ComputeVolume(worleyShader, settings);
     }
-
-    void SetUniform4f(const std::string& name, float v0, float v1, float v2, float v3)
+    ComputeVolume* StartBake(Texture* shape, Texture* detail, int dim, float detailScale, bool halfFloat)
     {
-        GLCall(glUniform4f(GetUniformLocation(name), v0, v1, v2, v3));
+        return new ComputeVolume(densityShader, shape, detail, dim, detailScale, halfFloat);
     }
-    void SetUniform3f(const std::string& name, float v0, float v1, float v2)
+    Texture* GenerateWorley(const NoiseSettings& settings)
     {
-        GLCall(glUniform3f(GetUniformLocation(name), v0, v1, v2));
+        ComputeVolume volume(worleyShader, settings);
+        return volume.Finish();
     }
-    void SetUniform1f(const std::string& name, float v0)
+    Texture* BakeDensity(Texture* shape, Texture* detail, int dim, float detailScale, bool halfFloat)
     {
-        GLCall(glUniform1f(GetUniformLocation(name), v0));
+        ComputeVolume volume(densityShader, shape, detail, dim, detailScale, halfFloat);
+        return volume.Finish();
     }
-    void SetUniformMatrix4fv(const std::string& name, const GLfloat* v)
+    VolumeReduction* StartReduction(Texture* volume, int dim, bool occupancy)
     {
-        /*glUniformMatrix4fv(GetUniformLocation(name), 1, GL_FALSE, );*/
-        GLCall(glUniformMatrix4fv(GetUniformLocation(name), 1, GL_FALSE, v));
+        // Max density grid cells of a finished volume, plus its threshold bits for a density
+        return new VolumeReduction(reduceShader, volume, dim, occupancy);
     }
-
 };
-typedef struct {
-    unsigned int TextureID;  // ID handle of the glyph texture
-    glm::ivec2   Size;       // Size of glyph
-    glm::ivec2   Bearing;    // Offset from baseline to left/top of glyph
-    unsigned int Advance;    // Offset to advance to next glyph
-}TextChar;
-class Texture
+class NoiseRegeneration
 {
+    // Rebuilds the cloud noise on a worker thread while the old textures keep rendering. Once the
+    // worker is done the volumes are streamed into new textures over the next frames; the owner
+    // swaps them in only when every upload has finished, so a frame never samples a partial volume.
+    // Volumes too large for the host are generated and uploaded slab by slab instead. With compute
+    // shaders the volumes are dispatched a few slabs per frame and reduced on the GPU; once a fence
+    // placed after the reductions has signalled they are read back and the worker builds the grids and
+    // distance field from them.
 private:
-    unsigned int textureID;
-    std::string filePath;
-    bool Dim3;
-    int height, width, bitsPerPixel;
+    ThreadPool* pool;
+    ComputeNoise* computeNoise;
+    std::thread worker;
+    std::atomic<bool> generated;
+    VolumeLevels levels[3];
+    VolumeUpload* uploads[3];
+    NoiseSlabStream* streams[2];
+    ComputeVolume* computed[3];
+    VolumeReduction* reductions[2];         // Shape, then the baked density when there is one
+    std::vector<glm::vec2> cellMaxima[2];
+    std::vector<unsigned int> occupancy;
+    GLsync fence;
 
-    glm::vec3*** CreatePositions(int nX, int nY, int nZ)
+public:
+    NoiseSettings shapeSettings, detailSettings;
+    float detailScale;
+    int densityMode;
+    NoiseVolume* shapeVolume;
+    NoiseVolume* detailVolume;
+    MaxDensityGrid* maxDensityGrid[2];
+    DistanceField* distanceField;
+
+    NoiseRegeneration(const NoiseSettings& shape, const NoiseSettings& detail, float scale, int mode, ThreadPool* threadPool, ComputeNoise* compute)
+        : pool(threadPool), computeNoise(nullptr), generated(false), fence(0), shapeSettings(shape), detailSettings(detail), detailScale(scale),
+        densityMode(mode), shapeVolume(nullptr), detailVolume(nullptr), distanceField(nullptr)
     {
-        glm::vec3 numCells = glm::vec3(nX, nY, nZ);
-        glm::vec3*** positions = new glm::vec3 * *[numCells.x];
-        for (int i = 0; i < numCells.x; ++i) {
-            positions[i] = new glm::vec3 * [numCells.y];
-            for (int j = 0; j < numCells.y; ++j) {
-                positions[i][j] = new glm::vec3[numCells.z];
-            }
-        }
-
-        glm::vec3 cellSize = 100.0f / numCells;
-
-        for (int i = 0; i < numCells.x; i++)
+        for (int i = 0; i < 3; i++) uploads[i] = nullptr;
+        for (int i = 0; i < 3; i++) computed[i] = nullptr;
+        for (int i = 0; i < 2; i++) reductions[i] = nullptr;
+        for (int i = 0; i < 2; i++) maxDensityGrid[i] = nullptr;
+        if (compute && ComputeNoise::Supports(shapeSettings) && ComputeNoise::Supports(detailSettings))
         {
-            for (int j = 0; j < numCells.y; j++)
-            {
-                for (int k = 0; k < numCells.z; k++)
-                {
-                    glm::vec3 pos;
-                    if (Random() > 0.6f)
-                    {
-                        pos = glm::vec3(1000.0f, 1000.0f, 1000.0f);
-                    }
-                    else
-                    {
-                        glm::vec3 randomOffset = glm::vec3(Random(), Random(), Random());
-                        pos = (glm::vec3(i, j, k) + randomOffset) * cellSize;
-                    }
-                    
-                    positions[i][j][k] = pos;
-                    //std::cout << pos.x << ", " << pos.y << ", " << pos.z << std::endl;
-                }
-            }
+            // The worker only starts once the volumes are done, the bake is started once both are dispatched
+            computeNoise = compute;
+            computed[0] = computeNoise->StartWorley(shapeSettings);
+            computed[1] = computeNoise->StartWorley(detailSettings);
+            streams[0] = streams[1] = nullptr;
+            return;
         }
+        streams[0] = NoiseSlabStream::Streamed(shapeSettings) ? new NoiseSlabStream(shapeSettings, pool) : nullptr;
+        streams[1] = NoiseSlabStream::Streamed(detailSettings) ? new NoiseSlabStream(detailSettings, pool) : nullptr;
 
-        return positions;
-    }
-    float* CreateWorley(int dimX, int dimY, int dimZ, int freq1, int freq2, int freq3, int freq4) // Dim is resolution of texture(number of disks in which the cell is being divided)
-    {
-        float* worleyNoise = new float[dimX * dimY * dimZ * 4];
-
-        // Points positions array
-        // Frequency is number of cells
-        glm::vec3 numCells1 = glm::vec3(freq1, freq1, freq1);
-        glm::vec3 numCells2 = glm::vec3(freq2, freq2, freq2);
-        glm::vec3 numCells3 = glm::vec3(freq3, freq3, freq3);
-        glm::vec3 numCells4 = glm::vec3(freq4, freq4, freq4);
-
-        glm::vec3*** positions1 = CreatePositions(numCells1.x, numCells1.y, numCells1.z);
-        glm::vec3*** positions2 = CreatePositions(numCells2.x, numCells2.y, numCells2.z);
-        glm::vec3*** positions3 = CreatePositions(numCells3.x, numCells3.y, numCells3.z);
-        glm::vec3*** positions4 = CreatePositions(numCells4.x, numCells4.y, numCells4.z);
-
-        // Define 3D texture
-        
-        for (int channel = 0; channel <= 3; channel++)
+        worker = std::thread([this]()
         {
-            float maxDist = -1.0f;
-            glm::vec3 numCells;
-            glm::vec3*** positions = nullptr;
-            if (channel == 0)
+            if (!streams[0])
             {
-                positions = positions1;
-                numCells = numCells1;
+                shapeVolume = new NoiseVolume(shapeSettings, pool);
+                levels[0] = NoiseVolumeLevels(*shapeVolume, pool);
+                maxDensityGrid[0] = new MaxDensityGrid(*shapeVolume, pool);
             }
-            if (channel == 1)
+            if (!streams[1])
             {
-                positions = positions2;
-                numCells = numCells2;
+                detailVolume = new NoiseVolume(detailSettings, pool);
+                levels[1] = NoiseVolumeLevels(*detailVolume, pool);
             }
-            if (channel == 2)
+            // Baking needs both volumes on the host, streamed ones are baked on the GPU later if at all
+            if ((densityMode == 1 || densityMode == 2) && shapeVolume && detailVolume)
             {
-                positions = positions3;
-                numCells = numCells3;
+                DensityVolume density(*shapeVolume, *detailVolume, detailScale, densityMode == 2, pool);
+                levels[2] = DensityVolumeLevels(density, pool);
+                maxDensityGrid[1] = new MaxDensityGrid(density, pool);
+                distanceField = new DistanceField(density, pool);
             }
-            if (channel == 3)
-            {
-                positions = positions4;
-                numCells = numCells4;
-            }
-
-            for (int i = 0; i < dimX; i++)
-            {
-                for (int j = 0; j < dimY; j++)
-                {
-                    for (int k = 0; k < dimZ; k++)
-                    {
-                        glm::vec3 voxelPos = 100.0f * glm::vec3((float)(i + 0.5f) / (float)dimX, (float)(j + 0.5f) / (float)dimY, (float)(k + 0.5f) / (float)dimZ);
-
-                        int cellIndexX = (int)(voxelPos.x * numCells.x) / 100.0f;
-                        int cellIndexY = (int)(voxelPos.y * numCells.y) / 100.0f;
-                        int cellIndexZ = (int)(voxelPos.z * numCells.z) / 100.0f;
-
-                        float minDist = 1000.0f;
-
-                        for (int ii = -1; ii <= 1; ii++)
-                        {
-                            for (int jj = -1; jj <= 1; jj++)
-                            {
-                                for (int kk = -1; kk <= 1; kk++)
-                                {
-                                    int queryIndexX = cellIndexX + ii;
-                                    int queryIndexY = cellIndexY + jj;
-                                    int queryIndexZ = cellIndexZ + kk;
-
-                                    bool xLow = false, xHigh = false, yLow = false, yHigh = false, zLow = false, zHigh = false;
-
-                                    if (queryIndexX < 0) { queryIndexX = numCells.x - 1; xLow = true; }
-                                    if (queryIndexX >= numCells.x) { queryIndexX = 0; xHigh = true; }
-
-                                    if (queryIndexY < 0) { queryIndexY = numCells.y - 1; yLow = true; }
-                                    if (queryIndexY >= numCells.y) { queryIndexY = 0; yHigh = true; }
-
-                                    if (queryIndexZ < 0) { queryIndexZ = numCells.z - 1; zLow = true; }
-                                    if (queryIndexZ >= numCells.z) { queryIndexZ = 0; zHigh = true; }
-
-                                    glm::vec3 queryPos = positions[queryIndexX][queryIndexY][queryIndexZ];
-
-                                    if (xLow) queryPos.x -= 100.0f;
-                                    if (yLow) queryPos.y -= 100.0f;
-                                    if (zLow) queryPos.z -= 100.0f;
-
-                                    if (xHigh) queryPos.x += 100.0f;
-                                    if (yHigh) queryPos.y += 100.0f;
-                                    if (zHigh) queryPos.z += 100.0f;
-
-                                    glm::vec3 dis = voxelPos - queryPos;
-                                    float dist = glm::dot(dis, dis);
+            generated = true;
+        });
+    }
+    ~NoiseRegeneration()
+    {
+        if (worker.joinable()) worker.join();
+        for (int i = 0; i < 3; i++) delete uploads[i];
+        for (int i = 0; i < 3; i++) delete computed[i];
+        for (int i = 0; i < 2; i++) delete reductions[i];
+        for (int i = 0; i < 2; i++) delete streams[i];
+        if (fence) glDeleteSync(fence);
+        delete shapeVolume;
+        delete detailVolume;
+        for (int i = 0; i < 2; i++) delete maxDensityGrid[i];
+        delete distanceField;
+    }
+    static const size_t FrameUploadBytes = 1 << 20;
+    static const size_t FrameComputeVoxels = 1 << 17;
 
-                                    if (dist < minDist) minDist = dist;
+    bool UpdateCompute()
+    {
+        size_t voxelBudget = FrameComputeVoxels;
+        for (int i = 0; i < 3; i++)
+        {
+            if (!computed[i]) continue;
+            while (!computed[i]->IsDone() && voxelBudget > 0) voxelBudget -= std::min(voxelBudget, computed[i]->Step(voxelBudget));
+            if (!computed[i]->IsDone()) return false;
+        }
+        if ((densityMode == 1 || densityMode == 2) && !computed[2])
+        {
+            computed[2] = computeNoise->StartBake(computed[0]->GetTexture(), computed[1]->GetTexture(), shapeSettings.resolution, detailScale, densityMode == 2);
+            return false;
+        }
 
-                                }
-                            }
-                        }
-                        if (minDist > maxDist) maxDist = minDist; // For normalization
-                        worleyNoise[channel + 4 * (i + dimX * (j + dimY * k))] = minDist;
-                    }
-                }
+        if (!fence)
+        {
+            int dim = shapeSettings.resolution;
+            reductions[0] = computeNoise->StartReduction(computed[0]->GetTexture(), dim, false);
+            if (computed[2]) reductions[1] = computeNoise->StartReduction(computed[2]->GetTexture(), dim, true);
+            fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            std::cout << "Worley noise " << shapeSettings.resolution << "^3 + " << detailSettings.resolution << "^3 dispatched on the GPU" << std::endl;
+        }
+        if (!worker.joinable())
+        {
+            // The read back only copies once the fence has signalled, the grids are built off the GL thread
+            if (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED) return false;
+            cellMaxima[0] = reductions[0]->ReadCellMaxima();
+            if (reductions[1])
+            {
+                cellMaxima[1] = reductions[1]->ReadCellMaxima();
+                occupancy = reductions[1]->ReadOccupancy();
             }
-
-            // Normalize distance
-            for (int i = 0; i < dimX; i++)
+            worker = std::thread([this]()
             {
-                for (int j = 0; j < dimY; j++)
+                int dim = shapeSettings.resolution;
+                maxDensityGrid[0] = new MaxDensityGrid(dim, cellMaxima[0], true, false, pool);
+                if (!occupancy.empty())
                 {
-                    for (int k = 0; k < dimZ; k++)
-                    {
-                        worleyNoise[channel + 4 * (i + dimX * (j + dimY * k))] = 1.0f - ((float)worleyNoise[channel + 4 * (i + dimX * (j + dimY * k))] / (float)maxDist);
-                        /*if (worleyNoise[channel + 3 * (i + dimX * (j + dimY * k))] < 0.7f)
-                            worleyNoise[channel + 3 * (i + dimX * (j + dimY * k))] = 0.0f;*/
-                        //std::cout << worleyNoise[i + dimX * (j + dimY * (k + dimZ * channel))] << std::endl;
-                    }
+                    maxDensityGrid[1] = new MaxDensityGrid(dim, cellMaxima[1], false, densityMode == 2, pool);
+                    distanceField = new DistanceField(dim, occupancy, pool);
                 }
-            }
-
-            for (int i = 0; i < numCells.x; ++i) {
-                for (int j = 0; j < numCells.y; ++j) {
-                    delete[] positions[i][j];
-                }
-                delete[] positions[i];
-            }
-            delete[] positions;
+                generated = true;
+            });
+            return false;
         }
-        
-        return worleyNoise;
+        if (!generated) return false;
+        worker.join();
+        return true;
     }
-public:
-    Texture(const std::string& path, const bool dim3)
-        : textureID(0), filePath(path), Dim3(dim3), height(0), width(0), bitsPerPixel(0)
+    bool Update()
     {
-        if (!dim3)
+        // Called once per frame on the GL thread, true once the new textures are complete
+        if (computeNoise) return UpdateCompute();
+        size_t byteBudget = FrameUploadBytes;
+        bool done = true;
+        for (int i = 0; i < 2; i++)
         {
-            glGenTextures(1, &textureID);
-            stbi_set_flip_vertically_on_load(1);
-            unsigned char* localBuffer = stbi_load(filePath.c_str(), &width, &height, &bitsPerPixel, 4);
-
-            // std::cout << filePath << " " << width << ", " << height << ", " << bitsPerPixel << std::endl;
-            if (!localBuffer) {
-                std::cerr << "Failed to load texture: " << filePath << std::endl;
-                return;
-            }
-
-            
-            glBindTexture(GL_TEXTURE_2D, textureID);
-
-            // Set texture parameters
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, localBuffer);
-            stbi_image_free(localBuffer);
-
-            glBindTexture(GL_TEXTURE_2D, 0);
+            if (!streams[i]) continue;
+            byteBudget -= std::min(byteBudget, streams[i]->Step(byteBudget, false));
+            done = done && streams[i]->IsDone();
         }
-        else
-        {
-            
-
-            int res = 64;
-            const int dimX = 64, dimY = 64, dimZ = 64;
-            float* worleyNoise = CreateWorley(dimX, dimY, dimZ, 4, 8, 16, 32);
-
-            // Create and bind a 3D texture
-            glGenTextures(1, &textureID);
-            glBindTexture(GL_TEXTURE_3D, textureID);
-
-            // Set texture parameters
-            GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT));
-            GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT));
-            GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT));
-            GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-            GLCall(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-
-            // Upload the Worley noise data to the 3D texture
-            GLCall(glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, dimX, dimY, dimZ, 0, GL_RGBA, GL_FLOAT, (void*)worleyNoise));
 
-            // Unbind the texture
-            GLCall(glBindTexture(GL_TEXTURE_3D, 0));
-
-            delete[] worleyNoise;
-
-            
-        }
-        
-    }
-    ~Texture()
-    {
-        glDeleteTextures(1, &textureID);
-    }
-    void Bind()
-    {
-        glActiveTexture(GL_TEXTURE0);
-        if(Dim3) glBindTexture(GL_TEXTURE_3D, textureID);
-        else glBindTexture(GL_TEXTURE_2D, textureID);
+        if (!generated) return false;
+        if (worker.joinable())
+        {
+            worker.join();
+            for (int i = 0; i < 3; i++)
+            {
+                if (!levels[i].levels.empty()) uploads[i] = new VolumeUpload(levels[i]);
+            }
+        }
+
+        for (int i = 0; i < 3; i++)
+        {
+            if (!uploads[i]) continue;
+            while (!uploads[i]->IsDone() && byteBudget > 0) byteBudget -= std::min(byteBudget, uploads[i]->Step(byteBudget));
+            done = done && uploads[i]->IsDone();
+        }
+        return done;
     }
-    void Unbind()
+    Texture* ReleaseTexture(int index)
     {
-        if (Dim3) glBindTexture(GL_TEXTURE_3D, 0);
-        else glBindTexture(GL_TEXTURE_2D, 0);
-        
+        // 0 shape, 1 detail, 2 baked density (nullptr when nothing was baked)
+        if (computed[index]) return computed[index]->Release();
+        if (index < 2 && streams[index]) return streams[index]->Release();
+        if (!uploads[index]) return nullptr;
+        return uploads[index]->Release();
     }
 };
 class Text
@@ -866,11 +3819,436 @@ public:
     glm::vec3 targetPoint;
     int view;
     float r, theta, phi;
+    float pixelSpread; // Width of a pixel at unit distance, for picking mip levels
+    float zNear, zFar;
+    glm::mat4 cameraMatrix, previousCameraMatrix; // Projection times view of this frame and of the one before
 
     Camera(App* app);
+    void UpdatePosition();
     void Update();
 };
 
+class CloudTarget
+{
+    // Renders the cloud offscreen and draws it over the scene. Each frame the scene depth is copied and reduced
+    // into a pyramid of nearest and farthest distances, then rays are marched at 1 / factor of the viewport's
+    // resolution, one per interleave block in turn, and end at the scene or are depth tested against it. The
+    // rest of each block is filled from the history, the result is upsampled guided by the full resolution
+    // depth and, with temporal accumulation, blended into a viewport sized history reprojected from the last
+    // frame. A static view is refined by averaging jittered frames until RefinementFrames are in.
+private:
+    unsigned int framebuffer, sceneFramebuffer, historyFramebuffer, pyramidFramebuffer;
+    unsigned int colorTexture, distanceTexture, depthTexture, sceneDepthTexture;
+    unsigned int reconstructedTexture, upsampledTexture, historyTexture[2], refinedTexture;
+    unsigned int depthPyramid;
+    int pyramidLevels;
+    unsigned int vertexArray;
+    int fullWidth, fullHeight, reducedWidth, reducedHeight;
+    int marchWidth, marchHeight; // Rays marched per frame along each axis
+    int viewport[4];
+    glm::ivec2 phase;            // Ray marched in each interleaved block this frame
+    unsigned int interleaveFrame;
+    int historyIndex; // historyTexture holding the latest accumulated cloud
+    bool historyValid;
+    std::vector<float> refinementKey; // Inputs of the frames in refinedTexture
+    int refinedFrames;
+    glm::vec2 jitter;                 // Offset of this frame's rays from the texel centres, in texels
+    Shader* shader;
+    Shader* reprojectShader;
+    Shader* interleaveShader;
+    Shader* pyramidShader;
+
+    static void Allocate(unsigned int texture, int width, int height, GLenum internalFormat, GLenum format, GLenum type, GLenum filter = GL_NEAREST)
+    {
+        GLCall(glBindTexture(GL_TEXTURE_2D, texture));
+        GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter));
+        GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter));
+        GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+        GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+        GLCall(glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr));
+        GLCall(glBindTexture(GL_TEXTURE_2D, 0));
+    }
+    static float Halton(int index, int base)
+    {
+        float result = 0.0f, fraction = 1.0f;
+        for (; index > 0; index /= base)
+        {
+            fraction /= base;
+            result += fraction * (index % base);
+        }
+        return result;
+    }
+    void Resize(int width, int height)
+    {
+        // Depth is 24 bit with stencil like the default framebuffer's, blits need matching formats
+        fullWidth = width;
+        fullHeight = height;
+        reducedWidth = (width + factor - 1) / factor;
+        reducedHeight = (height + factor - 1) / factor;
+        marchWidth = (reducedWidth + interleave - 1) / interleave;
+        marchHeight = (reducedHeight + interleave - 1) / interleave;
+        Allocate(colorTexture, marchWidth, marchHeight, GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT);
+        Allocate(distanceTexture, marchWidth, marchHeight, GL_R32F, GL_RED, GL_FLOAT);
+        Allocate(reconstructedTexture, reducedWidth, reducedHeight, GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT);
+        Allocate(upsampledTexture, width, height, GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT);
+        for (int i = 0; i < 2; i++) Allocate(historyTexture[i], width, height, GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, GL_LINEAR);
+        historyValid = false;
+        Allocate(refinedTexture, width, height, GL_RGBA32F, GL_RGBA, GL_FLOAT);
+        refinedFrames = 0;
+        Allocate(depthTexture, marchWidth, marchHeight, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+        Allocate(sceneDepthTexture, width, height, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+
+        // Every level down to 1x1, each half the one above it rounded down
+        pyramidLevels = 1;
+        while ((std::max(width, height) >> pyramidLevels) > 0) pyramidLevels++;
+        GLCall(glBindTexture(GL_TEXTURE_2D, depthPyramid));
+        for (int level = 0; level < pyramidLevels; level++)
+        {
+            GLCall(glTexImage2D(GL_TEXTURE_2D, level, GL_RG32F, std::max(width >> level, 1), std::max(height >> level, 1), 0, GL_RG, GL_FLOAT, nullptr));
+        }
+        GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST));
+        GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+        GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+        GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+        GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0));
+        GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, pyramidLevels - 1));
+        GLCall(glBindTexture(GL_TEXTURE_2D, 0));
+
+        GLCall(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer));
+        GLCall(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0));
+        GLCall(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, distanceTexture, 0));
+        GLCall(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0));
+        GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        GLCall(glDrawBuffers(2, drawBuffers));
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) std::cerr << "Cloud target is incomplete" << std::endl;
+        GLCall(glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer));
+        GLCall(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, sceneDepthTexture, 0));
+        GLCall(glDrawBuffer(GL_NONE));
+        GLCall(glReadBuffer(GL_NONE));
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) std::cerr << "Scene depth target is incomplete" << std::endl;
+        GLCall(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    }
+public:
+    int factor;                // Viewport pixels per cloud texel along each axis
+    bool temporal;             // Accumulate the cloud over frames
+    int interleave;            // Cloud texels per marched ray along each axis, a power of two
+    glm::vec4 marchTransform;  // Scale minus 1 and offset taking the cloud's clip space onto this frame's rays
+    bool refine;               // Average jittered frames while the view is static
+    bool depthClamp;           // End the march at the opaque scene, read from the depth pyramid
+    static const int RefinementFrames = 256;
+    static const int TileLevels = 3; // Rays across a tile of the occlusion test, as a power of two
+
+    CloudTarget()
+        : pyramidLevels(0), fullWidth(0), fullHeight(0), reducedWidth(0), reducedHeight(0), marchWidth(0), marchHeight(0), phase(0), interleaveFrame(0),
+        historyIndex(0), historyValid(false), refinedFrames(0), jitter(0.0f), factor(1), temporal(false), interleave(1), marchTransform(0.0f), refine(false), depthClamp(true)
+    {
+        GLCall(glGenFramebuffers(1, &framebuffer));
+        GLCall(glGenFramebuffers(1, &sceneFramebuffer));
+        GLCall(glGenFramebuffers(1, &historyFramebuffer));
+        GLCall(glGenFramebuffers(1, &pyramidFramebuffer));
+        GLCall(glGenTextures(1, &colorTexture));
+        GLCall(glGenTextures(1, &distanceTexture));
+        GLCall(glGenTextures(1, &depthTexture));
+        GLCall(glGenTextures(1, &sceneDepthTexture));
+        GLCall(glGenTextures(1, &reconstructedTexture));
+        GLCall(glGenTextures(1, &upsampledTexture));
+        GLCall(glGenTextures(2, historyTexture));
+        GLCall(glGenTextures(1, &refinedTexture));
+        GLCall(glGenTextures(1, &depthPyramid));
+        GLCall(glGenVertexArrays(1, &vertexArray));
+        shader = new Shader("resources/shaders/shader_upsample.glsl");
+        reprojectShader = new Shader("resources/shaders/shader_reproject.glsl");
+        interleaveShader = new Shader("resources/shaders/shader_reproject.glsl", std::vector<std::string>(1, "INTERLEAVE_PASS"));
+        pyramidShader = new Shader("resources/shaders/shader_depth_pyramid.glsl");
+    }
+    ~CloudTarget()
+    {
+        GLCall(glDeleteFramebuffers(1, &framebuffer));
+        GLCall(glDeleteFramebuffers(1, &sceneFramebuffer));
+        GLCall(glDeleteFramebuffers(1, &historyFramebuffer));
+        GLCall(glDeleteFramebuffers(1, &pyramidFramebuffer));
+        GLCall(glDeleteTextures(1, &colorTexture));
+        GLCall(glDeleteTextures(1, &distanceTexture));
+        GLCall(glDeleteTextures(1, &depthTexture));
+        GLCall(glDeleteTextures(1, &sceneDepthTexture));
+        GLCall(glDeleteTextures(1, &reconstructedTexture));
+        GLCall(glDeleteTextures(1, &upsampledTexture));
+        GLCall(glDeleteTextures(2, historyTexture));
+        GLCall(glDeleteTextures(1, &refinedTexture));
+        GLCall(glDeleteTextures(1, &depthPyramid));
+        GLCall(glDeleteVertexArrays(1, &vertexArray));
+        delete shader;
+        delete reprojectShader;
+        delete interleaveShader;
+        delete pyramidShader;
+    }
+    bool Accumulates() const
+    {
+        // Skipped rays are filled from the history
+        return temporal || interleave > 1;
+    }
+    bool Enabled() const
+    {
+        // Full resolution without accumulation or the depth pyramid draws the cloud straight into the scene
+        return factor > 1 || Accumulates() || refine || depthClamp;
+    }
+    void Refine(const std::vector<float>& key)
+    {
+        // Starts the average over when any input of the cloud differs from the frames already in it
+        GLint current[4];
+        GLCall(glGetIntegerv(GL_VIEWPORT, current));
+        if (!refine || key != refinementKey || current[2] != fullWidth || current[3] != fullHeight) refinedFrames = 0;
+        refinementKey = key;
+    }
+    bool Converged() const
+    {
+        // The average is final and is drawn without marching
+        return refine && refinedFrames >= RefinementFrames;
+    }
+    int RefinedFrames() const { return refine ? refinedFrames : 0; }
+    float JitterRotation() const
+    {
+        // Golden ratio steps of the ray start offsets, the blue noise repeats after a few frames
+        return refine ? std::fmod(refinedFrames * 0.618034f, 1.0f) : 0.0f;
+    }
+    void Begin(const Camera& camera)
+    {
+        // Redirects drawing into the reduced target, after the opaque scene is in the default framebuffer
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        int width = viewport[2], height = viewport[3];
+        if (width != fullWidth || height != fullHeight || (width + factor - 1) / factor != reducedWidth || (height + factor - 1) / factor != reducedHeight ||
+            (reducedWidth + interleave - 1) / interleave != marchWidth || (reducedHeight + interleave - 1) / interleave != marchHeight)
+            Resize(width, height);
+
+        // Bayer order through each block, so the rays of the last few frames are spread over it
+        int index = interleaveFrame++ % (interleave * interleave);
+        phase = glm::ivec2(0);
+        for (int bit = interleave >> 1; bit > 0; bit >>= 1, index >>= 2)
+            phase += bit * glm::ivec2((index ^ (index >> 1)) & 1, index & 1);
+
+        // Refined frames move every ray around its texel. Interleaved rays are not, their reconstruction
+        // takes each one to be at its texel's centre.
+        jitter = glm::vec2(0.0f);
+        if (refine && interleave == 1 && refinedFrames > 0) jitter = glm::vec2(Halton(refinedFrames, 2), Halton(refinedFrames, 3)) - 0.5f;
+
+        // March texel j takes the ray through reduced texel interleave * j + phase. The raster puts texel j
+        // at (j + 0.5) / march size, so the cloud's clip space is scaled and shifted until that ray lands there.
+        glm::vec2 reduced(reducedWidth, reducedHeight), march(marchWidth, marchHeight);
+        glm::vec2 ray = glm::vec2(phase) + 0.5f + jitter;
+        glm::vec2 scale = reduced / (march * (float)interleave);
+        glm::vec2 offset = scale - 1.0f + (1.0f - 2.0f * ray / (float)interleave) / march;
+        marchTransform = glm::vec4(scale - 1.0f, offset);
+
+        // Depth for the march target is point sampled under each ray, the upsample sorts out the edges.
+        // Clamped rays do without it.
+        int step = interleave * factor;
+        glm::ivec2 origin = glm::ivec2(glm::floor((ray - 0.5f * interleave) * (float)factor));
+        GLCall(glBindFramebuffer(GL_READ_FRAMEBUFFER, 0));
+        GLCall(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, sceneFramebuffer));
+        GLCall(glBlitFramebuffer(viewport[0], viewport[1], viewport[0] + width, viewport[1] + height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST));
+        if (depthClamp) BuildDepthPyramid(camera);
+        else
+        {
+            GLCall(glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFramebuffer));
+            GLCall(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer));
+            GLCall(glBlitFramebuffer(origin.x, origin.y, origin.x + step * marchWidth, origin.y + step * marchHeight, 0, 0, marchWidth, marchHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST));
+        }
+
+        GLCall(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer));
+        GLCall(glViewport(0, 0, marchWidth, marchHeight));
+        GLCall(glClearColor(0.0f, 0.0f, 0.0f, 0.0f));
+        GLCall(glClear(GL_COLOR_BUFFER_BIT));
+
+        // The depth copy stays the scene's and colour is accumulated premultiplied. The distance is written
+        // with alpha 1, so the same blend replaces it
+        GLCall(glDepthMask(GL_FALSE));
+        if (depthClamp)
+        {
+            GLCall(glDisable(GL_DEPTH_TEST));
+        }
+        GLCall(glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+    }
+    void BuildDepthPyramid(const Camera& camera)
+    {
+        // Level 0 from the scene depth, then each level from the one above it. The level read is the only
+        // one in the texture's range while the next is written, and level 0 is written with the pyramid
+        // unbound, so no level is read and written at once.
+        glm::mat4 inverseCameraMatrix = glm::inverse(camera.cameraMatrix);
+        pyramidShader->Bind();
+        pyramidShader->SetUniform1i("sceneDepth", 0);
+        pyramidShader->SetUniform1i("depthPyramid", 1);
+        pyramidShader->SetUniformMatrix4fv("inverseCameraMatrix", &inverseCameraMatrix[0][0]);
+        pyramidShader->SetUniform3f("cameraPosition", camera.camPosition.x, camera.camPosition.y, camera.camPosition.z);
+        GLCall(glActiveTexture(GL_TEXTURE0));
+        GLCall(glBindTexture(GL_TEXTURE_2D, sceneDepthTexture));
+        GLCall(glActiveTexture(GL_TEXTURE1));
+        GLCall(glBindTexture(GL_TEXTURE_2D, 0));
+        GLCall(glDisable(GL_BLEND));
+        GLCall(glBindFramebuffer(GL_FRAMEBUFFER, pyramidFramebuffer));
+        GLCall(glBindVertexArray(vertexArray));
+        for (int level = 0; level < pyramidLevels; level++)
+        {
+            if (level > 0)
+            {
+                GLCall(glBindTexture(GL_TEXTURE_2D, depthPyramid));
+                GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1));
+                GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1));
+            }
+            GLCall(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, depthPyramid, level));
+            GLCall(glViewport(0, 0, std::max(fullWidth >> level, 1), std::max(fullHeight >> level, 1)));
+            pyramidShader->SetUniform1i("level", level);
+            GLCall(glDrawArrays(GL_TRIANGLES, 0, 3));
+        }
+        GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0));
+        GLCall(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, pyramidLevels - 1));
+        GLCall(glBindVertexArray(0));
+        GLCall(glActiveTexture(GL_TEXTURE0));
+        GLCall(glEnable(GL_BLEND));
+    }
+    void SetDepthUniforms(Shader* target)
+    {
+        // Scene distances the cloud pass clamps its rays to, on unit 7. A ray's footprint is factor pixels.
+        int rayLevel = 0;
+        while ((1 << rayLevel) < factor) rayLevel++;
+        int top = std::max(pyramidLevels - 1, 0);
+        GLCall(glActiveTexture(GL_TEXTURE7));
+        GLCall(glBindTexture(GL_TEXTURE_2D, depthPyramid));
+        GLCall(glActiveTexture(GL_TEXTURE0));
+        target->SetUniform1i("depthPyramid", 7);
+        target->SetUniform1i("sceneDepthClamp", depthClamp);
+        target->SetUniform1i("rayDepthLevel", std::min(rayLevel, top));
+        target->SetUniform1i("tileDepthLevel", std::min(rayLevel + TileLevels, top));
+    }
+    void Upsample(const Camera& camera, unsigned int cloud, glm::vec2 gridSize, glm::vec2 gridOrigin)
+    {
+        // Draws cloud over the bound target at full resolution. gridSize texels of it span the viewport and
+        // the first one's ray is gridOrigin texels in.
+        shader->Bind();
+        GLCall(glActiveTexture(GL_TEXTURE0));
+        GLCall(glBindTexture(GL_TEXTURE_2D, cloud));
+        GLCall(glActiveTexture(GL_TEXTURE1));
+        GLCall(glBindTexture(GL_TEXTURE_2D, sceneDepthTexture));
+        GLCall(glActiveTexture(GL_TEXTURE0));
+        shader->SetUniform1i("cloudColor", 0);
+        shader->SetUniform1i("sceneDepth", 1);
+        shader->SetUniform2f("cloudGridSize", gridSize.x, gridSize.y);
+        shader->SetUniform2f("cloudGridOrigin", gridOrigin.x, gridOrigin.y);
+        shader->SetUniform1f("zNear", camera.zNear);
+        shader->SetUniform1f("zFar", camera.zFar);
+        GLCall(glBindVertexArray(vertexArray));
+        GLCall(glDrawArrays(GL_TRIANGLES, 0, 3));
+        GLCall(glBindVertexArray(0));
+    }
+    void BindReprojection(Shader* pass, const Camera& camera, glm::vec3 cloudMotion, unsigned int cloud)
+    {
+        // Inputs both history passes read, units 0 and up are left to the pass's own
+        glm::mat4 inverseCameraMatrix = glm::inverse(camera.cameraMatrix);
+        pass->Bind();
+        GLCall(glActiveTexture(GL_TEXTURE1));
+        GLCall(glBindTexture(GL_TEXTURE_2D, cloud));
+        GLCall(glActiveTexture(GL_TEXTURE2));
+        GLCall(glBindTexture(GL_TEXTURE_2D, distanceTexture));
+        GLCall(glActiveTexture(GL_TEXTURE3));
+        GLCall(glBindTexture(GL_TEXTURE_2D, historyTexture[historyIndex]));
+        GLCall(glActiveTexture(GL_TEXTURE0));
+        pass->SetUniform1i("cloudColor", 1);
+        pass->SetUniform1i("cloudDistance", 2);
+        pass->SetUniform1i("history", 3);
+        pass->SetUniform1i("historyValid", historyValid);
+        pass->SetUniformMatrix4fv("inverseCameraMatrix", &inverseCameraMatrix[0][0]);
+        pass->SetUniformMatrix4fv("previousCameraMatrix", &camera.previousCameraMatrix[0][0]);
+        pass->SetUniform3f("cameraPosition", camera.camPosition.x, camera.camPosition.y, camera.camPosition.z);
+        pass->SetUniform3f("cloudMotion", cloudMotion.x, cloudMotion.y, cloudMotion.z);
+        pass->SetUniform1f("zFar", camera.zFar);
+    }
+    void Composite(const Camera& camera, glm::vec3 cloudMotion)
+    {
+        // Upsamples the reduced target over the default framebuffer and restores the state Begin changed
+        GLCall(glDepthMask(GL_TRUE));
+        GLCall(glDisable(GL_DEPTH_TEST));
+        marchTransform = glm::vec4(0.0f);
+        unsigned int cloud = colorTexture;
+        glm::vec2 gridSize = glm::vec2(reducedWidth, reducedHeight);
+        glm::vec2 gridOrigin = glm::vec2(0.5f) + jitter;
+        bool converged = Converged();
+        if (converged) historyValid = false;
+        else if (Accumulates())
+        {
+            int next = historyIndex ^ 1;
+            GLCall(glDisable(GL_BLEND));
+            GLCall(glBindFramebuffer(GL_FRAMEBUFFER, historyFramebuffer));
+            GLCall(glBindVertexArray(vertexArray));
+            if (interleave > 1)
+            {
+                // Fills the rays skipped this frame in from the history
+                GLCall(glViewport(0, 0, reducedWidth, reducedHeight));
+                GLCall(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, reconstructedTexture, 0));
+                BindReprojection(interleaveShader, camera, cloudMotion, colorTexture);
+                interleaveShader->SetUniform1i("interleave", interleave);
+                interleaveShader->SetUniform2i("phase", phase.x, phase.y);
+                GLCall(glDrawArrays(GL_TRIANGLES, 0, 3));
+                cloud = reconstructedTexture;
+            }
+
+            // Without accumulation the upsampled frame is the history the next one fills skipped rays from,
+            // with it the frame is blended into the history read where each pixel's cloud was last frame
+            GLCall(glViewport(0, 0, fullWidth, fullHeight));
+            GLCall(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, temporal ? upsampledTexture : historyTexture[next], 0));
+            Upsample(camera, cloud, gridSize, gridOrigin);
+            if (temporal)
+            {
+                GLCall(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, historyTexture[next], 0));
+                BindReprojection(reprojectShader, camera, cloudMotion, cloud);
+                GLCall(glBindTexture(GL_TEXTURE_2D, upsampledTexture));
+                reprojectShader->SetUniform1i("upsampledColor", 0);
+                GLCall(glBindVertexArray(vertexArray));
+                GLCall(glDrawArrays(GL_TRIANGLES, 0, 3));
+                GLCall(glBindVertexArray(0));
+            }
+
+            // The history matches the viewport, so the last upsample is a copy
+            GLCall(glEnable(GL_BLEND));
+            historyIndex = next;
+            historyValid = true;
+            cloud = historyTexture[next];
+            gridSize = glm::vec2(fullWidth, fullHeight);
+            gridOrigin = glm::vec2(0.5f);
+        }
+        else historyValid = false;
+
+        if (refine)
+        {
+            if (!converged)
+            {
+                // Running average, frame n is blended in with weight 1 / n over a float target
+                GLCall(glBindFramebuffer(GL_FRAMEBUFFER, historyFramebuffer));
+                GLCall(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, refinedTexture, 0));
+                GLCall(glViewport(0, 0, fullWidth, fullHeight));
+                refinedFrames++;
+                if (refinedFrames == 1)
+                {
+                    GLCall(glDisable(GL_BLEND));
+                }
+                GLCall(glBlendColor(0.0f, 0.0f, 0.0f, 1.0f / refinedFrames));
+                GLCall(glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA));
+                Upsample(camera, cloud, gridSize, gridOrigin);
+                GLCall(glEnable(GL_BLEND));
+            }
+            cloud = refinedTexture;
+            gridSize = glm::vec2(fullWidth, fullHeight);
+            gridOrigin = glm::vec2(0.5f);
+        }
+
+        GLCall(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+        GLCall(glViewport(viewport[0], viewport[1], viewport[2], viewport[3]));
+        GLCall(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+        Upsample(camera, cloud, gridSize, gridOrigin);
+
+        GLCall(glEnable(GL_DEPTH_TEST));
+        GLCall(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+    }
+};
+
 class Light
 {
 private:
@@ -1043,7 +4421,11 @@ private:
 
     std::vector <IndexBuffer*> IBOs;
     Shader* shader;
-    Texture* texture;
+    Texture* shapeTexture;
+    Texture* detailTexture;
+    Texture* densityTexture;
+    NoiseVolume* shapeVolume;
+    NoiseVolume* detailVolume;
     Renderer* renderer;
 
     App* appState;
@@ -1070,6 +4452,49 @@ public:
     float shadow_samples;
 
     glm::vec3 cloudOffset;
+    glm::vec3 previousCloudOffset; // cloudOffset the previous frame was drawn with
+    NoiseSettings shapeSettings;
+    NoiseSettings detailSettings;
+    float detailScale;
+    int densityMode;         // 0 raw shape and detail noise, 1 baked R8 density, 2 baked R16F density, 3 procedural
+    bool proceduralCompiled; // Shaders are built with PROCEDURAL_DENSITY
+    glm::vec4 proceduralRange; // Largest squared distance of each procedural Worley channel, in cells
+    int bakedDensityMode;    // Format densityTexture was last baked in
+    bool mipLod;             // Sample coarser mips where the footprint of a sample spans several texels
+    NoiseSettings shapeEdit;       // Settings being tuned in the UI, regenerated in the background when they differ
+    NoiseSettings detailEdit;
+    NoiseRegeneration* regeneration;
+    ProgressiveNoise* progressive[2]; // Startup uploads of the shape and detail volumes still refining
+    Texture* blueNoiseTexture[2];     // 128^2 blue noise and 64^2 x 16 spatiotemporal blue noise
+    int jitterMode;                   // Ray start offset: 0 fixed, 1 blue noise, 2 spatiotemporal blue noise
+    static const int LightVolumeSize = 64, LightVolumeDepth = 16;
+    bool lightVolumeEnabled;          // Read transmittance from lightVolume instead of marching to the light per sample
+    bool lightVolumeDirty;            // Noise textures changed since lightVolume was rendered
+    Texture* lightVolume;
+    Shader* lightVolumeShader;        // shader_cloud.glsl built with LIGHT_VOLUME_PASS
+    unsigned int lightVolumeFramebuffer, lightVolumeVertexArray;
+    std::vector<float> lightVolumeKey; // Inputs the light volume was rendered with, except cloudOffset
+    glm::ivec3 lightVolumeOrigin;      // cloudOffset in light volume texels when it was last scrolled
+    int lightVolumeRefreshSlice;       // Next slice re-rendered while scrolling
+    MaxDensityGrid* maxDensityGrid[2]; // Bounds of the raw noise and of the baked density, nullptr without a host copy
+    Texture* occupancyTexture[2];
+    Texture* distanceField;            // Sphere tracing radius over the baked density, nullptr until one is baked
+    int skippingMode;                  // Empty space: 0 fixed steps, 1 occupancy grid, 2 distance field
+    float transmittanceEpsilon;        // Marches stop once less light than this gets through, 0 never stops early
+    int airStride;                     // View samples stepped at once while in air, 1 keeps a fixed step
+    int lightMarchMode;                // 0 even steps out of the box, 1 fixed count of cone samples
+    unsigned int densityRevision;      // Bumped whenever the textures the density is sampled from change
+
+    bool GenerateNoiseOnGPU();
+    Texture* StartNoiseTexture(const NoiseSettings& settings, NoiseVolume*& volume, ProgressiveNoise*& upload);
+    void BakeDensity();
+    void SetDensityUniforms(Shader* target);
+    void UpdateProceduralRange();
+    void SetSkippingUniforms(Shader* target, glm::vec3 offset);
+    void SetMaxDensityGrid(int index, MaxDensityGrid* grid);
+    void SetDistanceField(DistanceField* field);
+    void UpdateLightVolume();
+    glm::mat4 GetModelMatrix() const;
 
     Object(App* app, std::string objname);
     ~Object()
@@ -1224,8 +4649,11 @@ private:
 public:
     GLFWwindow* window;
     Renderer* renderer;
+    ThreadPool* threadPool;
+    ComputeNoise* computeNoise; // Null when the context is older than 4.3
     Camera* camera;
     Text* text;
+    CloudTarget* cloudTarget;
     std::vector<Shader*> shaders;
     ImGuiIO io;
 
@@ -1235,12 +4663,22 @@ public:
     int height;
     int width;
     float deltaTime;
+    unsigned int frameIndex;
+    bool proceduralDensity; // Start with the texture free density and no noise volumes
+    bool benchmarking; // Memory reports are printed only for the render benchmark
 
-    App()
+    App(bool benchmark = false, bool procedural = false)
     {
+        proceduralDensity = procedural;
+        benchmarking = benchmark;
+        frameIndex = 0;
+
         // Seed Random Generator
         std::srand(static_cast<unsigned int>(std::time(nullptr)));
 
+        // Worker threads for CPU side generation
+        threadPool = new ThreadPool();
+
         // Setup OpenGL and Imgui
         height = 1000, width = 1920;
         window = OpenGLInit(width, height);
@@ -1254,6 +4692,14 @@ public:
         shaders.push_back(new Shader("resources/shaders/shader_1.glsl"));
         shaders.push_back(new Shader("resources/shaders/shader_cloud.glsl"));
         shaders.push_back(new Shader("resources/shaders/shader_light.glsl"));
+        cloudTarget = new CloudTarget();
+
+        // Generate noise on the GPU when compute shaders are available
+        computeNoise = nullptr;
+        if (LoadComputeFunctions((GLADloadproc)glfwGetProcAddress)) computeNoise = new ComputeNoise();
+        LoadBufferStorage((GLADloadproc)glfwGetProcAddress);
+        std::cout << "OpenGL " << GLVersion.major << "." << GLVersion.minor << ", noise generated on the "
+            << (computeNoise ? "GPU" : "CPU") << std::endl;
 
         // Create Camera;
         camera = new Camera(this);
@@ -1262,17 +4708,21 @@ public:
         text = new Text(shaders[0]);
 
         SceneInit();
-        MainLoop();
+        if (benchmark) RenderBenchmark();
+        else MainLoop();
     }
     ~App()
     {
         delete(camera);  
         delete(text);
+        delete(cloudTarget);
         delete(renderer);
         for (int i = 0; i < shaders.size(); i++) delete(shaders[i]);
 
         for (int i = 0; i < objects.size(); i++) delete(objects[i]);
         delete(light);
+        delete(computeNoise);
+        delete(threadPool);
 
         ImGui_ImplOpenGL3_Shutdown();
         ImGui_ImplGlfw_Shutdown();
@@ -1283,15 +4733,21 @@ public:
     }
     GLFWwindow* OpenGLInit(unsigned int width, unsigned int height)
     {
-        // Set up GLFW
+        // Set up GLFW, asking for 4.3 for compute shaders and falling back to 3.3
         glfwInit();
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
         glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
         glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
         // Create window
         GLFWwindow* window0 = glfwCreateWindow(width, height, "Clouds", NULL, NULL);
         if (!window0)
+        {
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+            window0 = glfwCreateWindow(width, height, "Clouds", NULL, NULL);
+        }
+        if (!window0)
         {
             glfwTerminate();
             return nullptr;
@@ -1385,9 +4841,7 @@ public:
         ImGui::SliderFloat("CameraPosition.theta", &camera->theta, 0, 2 * PI);
         ImGui::SliderFloat("CameraPosition.phi", &camera->phi, 0, 2 * PI);
 
-        camera->camPosition.x = camera->r * std::cos(camera->phi) * std::sin(camera->theta);
-		camera->camPosition.y = camera->r * std::sin(camera->phi) * std::sin(camera->theta);
-		camera->camPosition.z = camera->r * std::cos(camera->theta);
+        camera->UpdatePosition();
 
         ImGui::Text("FPS: %.3f", 1 / deltaTime);
         ImGui::End();
@@ -1400,6 +4854,44 @@ public:
         ImGui::SliderFloat("Max Density", &objects[1]->maxDensity, 0.0f, 100.0f);
         //ImGui::SliderFloat("Fall Off", &objects[1]->falloff, 0.0f, 10.0f);
         ImGui::SliderFloat("Cloud Scale", &objects[1]->cloudScale, 0.0f, 2.0f);
+        ImGui::Combo("Density", &objects[1]->densityMode, "Raw noise\0Baked R8\0Baked R16F\0Procedural\0");
+        ImGui::Checkbox("Mip LOD", &objects[1]->mipLod);
+        ImGui::Combo("Ray jitter", &objects[1]->jitterMode, "Fixed offset\0Blue noise\0Spatiotemporal blue noise\0");
+        ImGui::Checkbox("Light volume", &objects[1]->lightVolumeEnabled);
+        ImGui::Combo("Empty space", &objects[1]->skippingMode, "Fixed steps\0Occupancy grid\0Distance field\0");
+        ImGui::SliderFloat("Transmittance epsilon", &objects[1]->transmittanceEpsilon, 0.0f, 0.1f);
+        ImGui::SliderInt("Air stride", &objects[1]->airStride, 1, 8);
+        ImGui::Combo("Light march", &objects[1]->lightMarchMode, "Even steps\0Cone\0");
+        int cloudResolution = 0;
+        while ((1 << cloudResolution) < cloudTarget->factor) cloudResolution++;
+        if (ImGui::Combo("Cloud resolution", &cloudResolution, "Full\0Half\0Quarter\0"))
+            cloudTarget->factor = 1 << cloudResolution;
+        ImGui::Checkbox("Temporal accumulation", &cloudTarget->temporal);
+        int interleaveIndex = cloudTarget->interleave >> 1;
+        if (ImGui::Combo("Rays per frame", &interleaveIndex, "All\0One in 2x2\0One in 4x4\0"))
+            cloudTarget->interleave = 1 << interleaveIndex;
+        ImGui::Checkbox("Refine while static", &cloudTarget->refine);
+        ImGui::Checkbox("Clamp to scene depth", &cloudTarget->depthClamp);
+        if (cloudTarget->refine) ImGui::Text("Refined frames: %d / %d", cloudTarget->RefinedFrames(), CloudTarget::RefinementFrames);
+        ImGui::Combo("Shape noise", &objects[1]->shapeEdit.generator, NoiseGeneratorNames, NumNoiseGenerators);
+        int shapeResolution = 0;
+        while ((64 << shapeResolution) < objects[1]->shapeEdit.resolution) shapeResolution++;
+        if (ImGui::Combo("Shape resolution", &shapeResolution, "64\0" "128\0" "256\0" "512\0"))
+            objects[1]->shapeEdit.resolution = 64 << shapeResolution;
+        ImGui::SliderInt("Shape freq.r", &objects[1]->shapeEdit.frequency[0], 1, 16);
+        ImGui::SliderInt("Shape freq.g", &objects[1]->shapeEdit.frequency[1], 1, 16);
+        ImGui::Combo("Detail noise", &objects[1]->detailEdit.generator, NoiseGeneratorNames, NumNoiseGenerators);
+        ImGui::SliderInt("Detail freq.r", &objects[1]->detailEdit.frequency[0], 1, 16);
+        ImGui::SliderInt("Detail freq.g", &objects[1]->detailEdit.frequency[1], 1, 16);
+        ImGui::SliderInt("Noise octaves", &objects[1]->shapeEdit.octaves, 1, 5);
+        objects[1]->detailEdit.octaves = objects[1]->shapeEdit.octaves;
+        int noiseSeed = (int)objects[1]->shapeEdit.seed;
+        if (ImGui::SliderInt("Noise seed", &noiseSeed, 1, 100))
+        {
+            objects[1]->shapeEdit.seed = noiseSeed;
+            objects[1]->detailEdit.seed = noiseSeed + 1;
+        }
+        if (objects[1]->regeneration) ImGui::Text("Regenerating noise...");
         ImGui::SliderFloat("Box Scale.x", &objects[1]->Scaling.x, 0.0f, 10.0f);
         ImGui::SliderFloat("Box Scale.y", &objects[1]->Scaling.y, 0.0f, 10.0f);
         ImGui::SliderFloat("Box Scale.z", &objects[1]->Scaling.z, 0.0f, 10.0f);
@@ -1432,14 +4924,50 @@ public:
     }
     void Update()
     {
+        frameIndex++;
         camera->Update();
         light->Update();
         for (int i = 0; i < objects.size(); i++) objects[i]->Update();
     }
+    std::vector<float> RefinementKey()
+    {
+        // Everything the cloud layer is drawn with, refined frames are averaged only while none of it changes
+        Object* cloud = objects[1];
+        float key[] = { light->lightPosition.x, light->lightPosition.y, light->lightPosition.z, light->lightColour.x, light->lightColour.y, light->lightColour.z,
+            cloud->Position.x, cloud->Position.y, cloud->Position.z, cloud->Rotation.x, cloud->Rotation.y, cloud->Rotation.z, cloud->Scaling.x, cloud->Scaling.y, cloud->Scaling.z,
+            cloud->cloudOffset.x, cloud->cloudOffset.y, cloud->cloudOffset.z, cloud->n_samples, cloud->n_lightSamples, cloud->maxDensity, cloud->falloff, cloud->cloudScale,
+            cloud->detailScale, (float)cloud->densityMode, (float)cloud->bakedDensityMode, (float)cloud->mipLod, (float)cloud->proceduralCompiled, (float)cloud->densityRevision,
+            (float)cloud->jitterMode, (float)cloud->lightVolumeEnabled, (float)cloud->skippingMode, cloud->transmittanceEpsilon, (float)cloud->airStride, (float)cloud->lightMarchMode,
+            objects[0]->Position.x, objects[0]->Position.y, objects[0]->Position.z, objects[0]->Rotation.x, objects[0]->Rotation.y, objects[0]->Rotation.z,
+            objects[0]->Scaling.x, objects[0]->Scaling.y, objects[0]->Scaling.z,
+            (float)cloudTarget->factor, (float)cloudTarget->temporal, (float)cloudTarget->interleave, (float)cloudTarget->depthClamp };
+        std::vector<float> inputs(key, key + sizeof(key) / sizeof(float));
+        inputs.insert(inputs.end(), &camera->cameraMatrix[0][0], &camera->cameraMatrix[0][0] + 16);
+        return inputs;
+    }
     void Draw()
     {
+        // Everything opaque first, the cloud is marched against the finished depth
         light->Draw();
-        for (int i = 0; i < objects.size(); i++) objects[i]->Draw();
+        for (int i = 0; i < objects.size(); i++)
+        {
+            if (i != 1) objects[i]->Draw();
+        }
+
+        // objects[1] is the cloud. A converged refinement is only composited.
+        Object* cloud = objects[1];
+        if (!cloudTarget->Enabled())
+        {
+            cloud->Draw();
+            return;
+        }
+        cloudTarget->Refine(RefinementKey());
+        if (!cloudTarget->Converged())
+        {
+            cloudTarget->Begin(*camera);
+            cloud->Draw();
+        }
+        cloudTarget->Composite(*camera, cloud->cloudOffset - cloud->previousCloudOffset);
     }
     void MainLoop() 
     {
@@ -1458,6 +4986,120 @@ public:
             glfwPollEvents();
         }
     }
+    void RenderBenchmark()
+    {
+        // Replays the same camera path for every case and reports the GPU time of the scene draw
+        typedef struct
+        {
+            std::string name;
+            std::function<void()> setup; // Runs after reset, sets everything the case changes from the baseline
+        }BenchmarkCase;
+
+        Object* cloud = objects[1];
+        const float baseSamples = cloud->n_samples;
+        const glm::vec3 baseScaling = cloud->Scaling;
+        auto reset = [this, cloud, baseSamples, baseScaling]()
+        {
+            // Baseline of every case: the startup settings with the box and sample count the benchmark began with
+            cloud->densityMode = 1;
+            cloud->mipLod = true;
+            cloud->skippingMode = 1;
+            cloud->lightVolumeEnabled = true;
+            cloud->transmittanceEpsilon = 0.01f;
+            cloud->airStride = 2;
+            cloud->lightMarchMode = 0;
+            cloud->jitterMode = 2;
+            cloud->n_samples = baseSamples;
+            cloud->Scaling = baseScaling;
+            cloudTarget->factor = 1;
+            cloudTarget->temporal = false;
+            cloudTarget->interleave = 1;
+            cloudTarget->refine = false;
+            cloudTarget->depthClamp = true;
+        };
+
+        std::vector<BenchmarkCase> cases;
+        cases.push_back({ "Raw noise, level 0", [cloud]() { cloud->densityMode = 0; cloud->mipLod = false; } });
+        cases.push_back({ "Raw noise, mip LOD", [cloud]() { cloud->densityMode = 0; } });
+        cases.push_back({ "Baked R8, level 0", [cloud]() { cloud->mipLod = false; } });
+        cases.push_back({ "Baked R8, mip LOD", []() {} });
+        cases.push_back({ "Baked R16F, mip LOD", [cloud]() { cloud->densityMode = 2; } });
+        cases.push_back({ "Procedural, no textures", [cloud]() { cloud->densityMode = 3; } });
+        cases.push_back({ "Baked R8, mip LOD, fixed steps", [cloud]() { cloud->skippingMode = 0; } });
+        cases.push_back({ "Baked R8, mip LOD, distance field", [cloud]() { cloud->skippingMode = 2; } });
+        cases.push_back({ "Baked R8, mip LOD, light march per sample", [cloud]() { cloud->lightVolumeEnabled = false; } });
+        cases.push_back({ "Baked R8, mip LOD, light march per sample, fixed steps", [cloud]() { cloud->lightVolumeEnabled = false; cloud->skippingMode = 0; } });
+        cases.push_back({ "Baked R8, mip LOD, light march per sample, distance field", [cloud]() { cloud->lightVolumeEnabled = false; cloud->skippingMode = 2; } });
+        cases.push_back({ "Baked R8, mip LOD, no early termination, fixed stride", [cloud]() { cloud->transmittanceEpsilon = 0.0f; cloud->airStride = 1; } });
+        cases.push_back({ "Baked R8, mip LOD, early termination, fixed stride", [cloud]() { cloud->airStride = 1; } });
+        cases.push_back({ "Baked R8, mip LOD, early termination, air stride 4", [cloud]() { cloud->airStride = 4; } });
+        cases.push_back({ "Baked R8, mip LOD, light march per sample, cone", [cloud]() { cloud->lightVolumeEnabled = false; cloud->lightMarchMode = 1; } });
+        cases.push_back({ "Baked R8, mip LOD, light march per sample, double box", [cloud, baseScaling]() { cloud->lightVolumeEnabled = false; cloud->Scaling = baseScaling * 2.0f; } });
+        cases.push_back({ "Baked R8, mip LOD, light march per sample, cone, double box", [cloud, baseScaling]() { cloud->lightVolumeEnabled = false; cloud->lightMarchMode = 1; cloud->Scaling = baseScaling * 2.0f; } });
+        cases.push_back({ "Baked R8, mip LOD, half resolution", [this]() { cloudTarget->factor = 2; } });
+        cases.push_back({ "Baked R8, mip LOD, quarter resolution", [this]() { cloudTarget->factor = 4; } });
+        cases.push_back({ "Baked R8, mip LOD, fixed offset", [cloud]() { cloud->jitterMode = 0; } });
+        cases.push_back({ "Baked R8, mip LOD, blue noise, half samples", [cloud, baseSamples]() { cloud->n_samples = baseSamples * 0.5f; } });
+        cases.push_back({ "Baked R8, mip LOD, temporal, quarter samples", [this, cloud, baseSamples]() { cloudTarget->temporal = true; cloud->n_samples = baseSamples * 0.25f; } });
+        cases.push_back({ "Baked R8, mip LOD, half samples, one ray in 2x2", [this, cloud, baseSamples]() { cloudTarget->interleave = 2; cloud->n_samples = baseSamples * 0.5f; } });
+        cases.push_back({ "Baked R8, mip LOD, half samples, one ray in 4x4", [this, cloud, baseSamples]() { cloudTarget->interleave = 4; cloud->n_samples = baseSamples * 0.5f; } });
+        cases.push_back({ "Baked R8, mip LOD, depth tested", [this]() { cloudTarget->depthClamp = false; } });
+        cases.push_back({ "Baked R8, mip LOD, clamped to the scene", []() {} });
+
+        std::cout << "Render benchmark on " << glGetString(GL_RENDERER) << std::endl;
+        cloud->play = false;
+
+        // Every case samples the full volumes, not the startup previews
+        while (cloud->progressive[0] || cloud->progressive[1])
+        {
+            cloud->Update();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        deltaTime = 1.0f / 60.0f;
+
+        const int warmupFrames = 10, frames = 240;
+        unsigned int query;
+        GLCall(glGenQueries(1, &query));
+        for (size_t c = 0; c < cases.size() && !glfwWindowShouldClose(window); c++)
+        {
+            reset();
+            cases[c].setup();
+
+            double totalMs = 0.0, worstMs = 0.0;
+            for (int frame = -warmupFrames; frame < frames; frame++)
+            {
+                // One orbit while pulling back from close up to far away, so both near and distant samples are timed
+                float t = std::max(frame, 0) / (float)frames;
+                camera->r = 15.0f + 60.0f * t;
+                camera->theta = 1.192f;
+                camera->phi = 2 * PI * t;
+                camera->UpdatePosition();
+
+                renderer->Clear(120.0f / 255.0f, 196.0f / 255.0f, 253.0f / 255.0f, 1.0f);
+                Update();
+
+                GLCall(glBeginQuery(GL_TIME_ELAPSED, query));
+                Draw();
+                GLCall(glEndQuery(GL_TIME_ELAPSED));
+
+                GLuint64 elapsed = 0;
+                GLCall(glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed));
+                if (frame >= 0)
+                {
+                    double ms = elapsed / 1.0e6;
+                    totalMs += ms;
+                    worstMs = std::max(worstMs, ms);
+                }
+
+                // Clear() started an ImGui frame, no UI is drawn while benchmarking
+                ImGui::EndFrame();
+                glfwSwapBuffers(window);
+                glfwPollEvents();
+            }
+            std::cout << cases[c].name << ": " << totalMs / frames << " ms mean, " << worstMs << " ms worst over " << frames << " frames" << std::endl;
+        }
+        GLCall(glDeleteQueries(1, &query));
+    }
     
 };
 
@@ -1551,9 +5193,92 @@ void Object::ObjectSpecifics()
         Scaling = glm::vec3(10.0f, 10.0f, 1.498f);
         Position = glm::vec3(0.0f, 0.0f, 8.42f);
         cloudOffset = glm::vec3(0.0f, 0.0f, 0.0f);
+        previousCloudOffset = cloudOffset;
         play = true;
 
-        texture = new Texture("", true);
+        // Low frequency shape volume, sampled everywhere
+        shapeSettings.generator = 0;
+        shapeSettings.resolution = 128;
+        shapeSettings.channels = 2;
+        shapeSettings.frequency[0] = 4;
+        shapeSettings.frequency[1] = 8;
+        shapeSettings.frequency[2] = 0;
+        shapeSettings.frequency[3] = 0;
+        shapeSettings.octaves = 3;
+        shapeSettings.seed = 1; // Fixed so the noise cache can be reused between launches
+
+        // High frequency detail volume, tiled detailScale times per shape period so its
+        // 4 and 8 cells act as 16 and 32. Only sampled where the shape is dense enough.
+        detailSettings = shapeSettings;
+        detailSettings.resolution = 32;
+        detailSettings.seed = 2;
+        detailScale = 4.0f;
+        UpdateProceduralRange();
+
+        shapeEdit = shapeSettings;
+        detailEdit = detailSettings;
+        regeneration = nullptr;
+        progressive[0] = nullptr;
+        progressive[1] = nullptr;
+
+        // Blue noise ray start offsets hide the banding of low sample counts
+        BlueNoise spatial(128, 1, 1, appState->threadPool);
+        BlueNoise spatiotemporal(64, 16, 1, appState->threadPool);
+        blueNoiseTexture[0] = new Texture(spatial.GetWidth(), spatial.GetDepth(), GL_R8, GL_RED, GL_UNSIGNED_BYTE, GL_NEAREST, GL_REPEAT, spatial.GetTexels());
+        blueNoiseTexture[1] = new Texture(spatiotemporal.GetWidth(), spatiotemporal.GetDepth(), GL_R8, GL_RED, GL_UNSIGNED_BYTE, GL_NEAREST, GL_REPEAT, spatiotemporal.GetTexels());
+        jitterMode = 2;
+
+        // Transmittance toward the light, 64^2 texels across the box and 16 through it, wrapped so it can scroll
+        lightVolumeEnabled = true;
+        lightVolumeDirty = true;
+        densityRevision = 0;
+        lightVolumeOrigin = glm::ivec3(0);
+        lightVolumeRefreshSlice = 0;
+        lightVolume = new Texture(LightVolumeSize, LightVolumeDepth, GL_R16F, GL_RED, GL_HALF_FLOAT, GL_LINEAR, GL_REPEAT, nullptr);
+        lightVolumeShader = new Shader("resources/shaders/shader_cloud.glsl", std::vector<std::string>(1, "LIGHT_VOLUME_PASS"));
+        GLCall(glGenFramebuffers(1, &lightVolumeFramebuffer));
+        GLCall(glGenVertexArrays(1, &lightVolumeVertexArray));
+
+        shapeTexture = nullptr;
+        detailTexture = nullptr;
+        densityTexture = nullptr;
+        shapeVolume = nullptr;
+        detailVolume = nullptr;
+        maxDensityGrid[0] = maxDensityGrid[1] = nullptr;
+        occupancyTexture[0] = occupancyTexture[1] = nullptr;
+        distanceField = nullptr;
+        skippingMode = 1;
+        transmittanceEpsilon = 0.01f;
+        airStride = 2;
+        lightMarchMode = 0;
+        if (appState->proceduralDensity)
+        {
+            // No noise volumes at all until another density mode is picked
+            std::cout << "Procedural density, no noise volumes allocated" << std::endl;
+        }
+        else if (!GenerateNoiseOnGPU())
+        {
+            shapeTexture = StartNoiseTexture(shapeSettings, shapeVolume, progressive[0]);
+            detailTexture = StartNoiseTexture(detailSettings, detailVolume, progressive[1]);
+            if (shapeVolume) SetMaxDensityGrid(0, new MaxDensityGrid(*shapeVolume, appState->threadPool));
+        }
+
+        // Remap baked once into a single channel, rebaked when the format is switched
+        mipLod = true;
+        densityMode = appState->proceduralDensity ? 3 : 1;
+        bakedDensityMode = 0;
+        proceduralCompiled = false;
+        BakeDensity();
+
+        // Compare against the single 64^3 RGBA8 volume with all four frequencies
+        if (appState->benchmarking && !appState->proceduralDensity)
+        {
+            size_t shapeBytes = NoiseVolumeBytes(shapeSettings), detailBytes = NoiseVolumeBytes(detailSettings);
+            std::cout << "Noise memory: shape " << shapeBytes / 1024 << " KiB + detail " << detailBytes / 1024 << " KiB = "
+                << (shapeBytes + detailBytes) / 1024 << " KiB (single 64^3 RGBA8: " << 64 * 64 * 64 * 4 / 1024 << " KiB)" << std::endl;
+            std::cout << "Texel bytes per density sample: " << 8 * shapeSettings.channels << " when the shape is empty, "
+                << 8 * (shapeSettings.channels + detailSettings.channels) << " otherwise (single RGBA8 volume: 32)" << std::endl;
+        }
     }
 
     VBO = new VertexBuffer(vertices.data(), vertices.size() * sizeof(float));
@@ -1565,9 +5290,200 @@ void Object::ObjectSpecifics()
     
 
     
+}
+bool Object::GenerateNoiseOnGPU()
+{
+    // Replaces the noise textures with compute generated ones, false when this has to run on the CPU
+    ComputeNoise* computeNoise = appState->computeNoise;
+    if (!computeNoise || !ComputeNoise::Supports(shapeSettings) || !ComputeNoise::Supports(detailSettings)) return false;
+
+    Texture* shape = computeNoise->GenerateWorley(shapeSettings);
+    Texture* detail = computeNoise->GenerateWorley(detailSettings);
+    std::cout << "Worley noise " << shapeSettings.resolution << "^3 + " << detailSettings.resolution << "^3 generated on the GPU" << std::endl;
+
+    delete shapeTexture;
+    delete detailTexture;
+    delete densityTexture;
+    delete shapeVolume;
+    delete detailVolume;
+    shapeTexture = shape;
+    detailTexture = detail;
+    densityTexture = nullptr;
+    shapeVolume = nullptr;
+    detailVolume = nullptr;
+    VolumeReduction* reduction = computeNoise->StartReduction(shape, shapeSettings.resolution, false);
+    SetMaxDensityGrid(0, new MaxDensityGrid(shapeSettings.resolution, reduction->ReadCellMaxima(), true, false, appState->threadPool));
+    SetMaxDensityGrid(1, nullptr);
+    SetDistanceField(nullptr);
+    delete reduction;
+    bakedDensityMode = 0;
+    lightVolumeDirty = true;
+    densityRevision++;
+    return true;
+}
+Texture* Object::StartNoiseTexture(const NoiseSettings& settings, NoiseVolume*& volume, ProgressiveNoise*& upload)
+{
+    // Volumes that would have to be generated are refined over the first frames instead of before them
+    upload = nullptr;
+    if (ProgressiveNoise::Cached(settings) || NoiseSlabStream::Streamed(settings))
+        return CreateNoiseTexture(settings, volume, appState->threadPool);
+
+    volume = nullptr;
+    upload = new ProgressiveNoise(settings, appState->threadPool);
+    return upload->GetTexture();
+}
+void Object::BakeDensity()
+{
+    // The bake reads the finished volumes, wait for the startup upload
+    if (progressive[0] || progressive[1]) return;
+    if ((densityMode != 1 && densityMode != 2) || densityMode == bakedDensityMode || !shapeTexture) return;
+
+    if ((!shapeVolume || !detailVolume) && !appState->computeNoise)
+    {
+        // Streamed noise has no host copy to bake from
+        std::cout << "Noise is streamed and compute shaders are unavailable, using raw noise" << std::endl;
+        densityMode = 0;
+        return;
+    }
+    if (!shapeVolume || !detailVolume)
+    {
+        // Noise only exists on the GPU, bake it there too and read back only the reductions of the bake
+        int dim = shapeSettings.resolution;
+        delete densityTexture;
+        densityTexture = appState->computeNoise->BakeDensity(shapeTexture, detailTexture, dim, detailScale, densityMode == 2);
+        VolumeReduction* reduction = appState->computeNoise->StartReduction(densityTexture, dim, true);
+        SetMaxDensityGrid(1, new MaxDensityGrid(dim, reduction->ReadCellMaxima(), false, densityMode == 2, appState->threadPool));
+        SetDistanceField(new DistanceField(dim, reduction->ReadOccupancy(), appState->threadPool));
+        delete reduction;
+        bakedDensityMode = densityMode;
+        return;
+    }
+
+    DensityVolume density(*shapeVolume, *detailVolume, detailScale, densityMode == 2, appState->threadPool);
+    delete densityTexture;
+    densityTexture = new Texture(DensityVolumeLevels(density, appState->threadPool));
+    SetMaxDensityGrid(1, new MaxDensityGrid(density, appState->threadPool));
+    SetDistanceField(new DistanceField(density, appState->threadPool));
+    bakedDensityMode = densityMode;
+
+    if (appState->benchmarking)
+        std::cout << "Density memory: " << density.GetBytes() / 1024 << " KiB, texel bytes per density sample: "
+            << 8 * density.GetBytes() / ((size_t)density.GetResolution() * density.GetResolution() * density.GetResolution()) << std::endl;
+}
+void Object::UpdateProceduralRange()
+{
+    // The Worley volumes remap by the largest squared distance over their voxels, in units of 0 to 100 per
+    // period. The procedural density measures in cells, so the same ranges are passed over scaled by the
+    // squared cell size. Cell units do not change with tiling, so the detail range holds at detailScale.
+    const NoiseSettings* settings[2] = { &shapeSettings, &detailSettings };
+    for (int channel = 0; channel < 4; channel++)
+    {
+        const NoiseSettings& source = *settings[channel / 2];
+        int frequency = source.frequency[channel % 2];
+        FeaturePointGrid grid(frequency, Hash(source.seed + channel % 2));
+        float cellSize = 100.0f / frequency;
+        proceduralRange[channel] = WorleyRange(grid, source.resolution, appState->threadPool) / (cellSize * cellSize);
+    }
+}
+void Object::SetDensityUniforms(Shader* target)
+{
+    // Inputs of DensityAtSamplePoint, shared by the cloud and the ground shadow
+    target->SetUniform1f("pixelSpread", appState->camera->pixelSpread);
+
+    // Ray start jitter, the spatiotemporal table moves to its next slice every frame
+    blueNoiseTexture[jitterMode == 2 ? 1 : 0]->Bind(3);
+    target->SetUniform1i("blueNoise", 3);
+    target->SetUniform1i("blueNoiseFrame", (int)(appState->frameIndex & 0x7fffffff));
+    target->SetUniform1f("jitterStrength", jitterMode == 0 ? 0.0f : 1.0f);
+    target->SetUniform1f("transmittanceEpsilon", transmittanceEpsilon);
+
+    SetSkippingUniforms(target, cloudOffset);
+
+    if (proceduralCompiled)
+    {
+        // Detail cells are tiled detailScale times per shape period, like the detail texture
+        int scale = (int)detailScale;
+        target->SetUniform4i("noiseFrequency", shapeSettings.frequency[0], shapeSettings.frequency[1],
+            detailSettings.frequency[0] * scale, detailSettings.frequency[1] * scale);
+        target->SetUniform4i("noiseSeed", (int)Hash(shapeSettings.seed), (int)Hash(shapeSettings.seed + 1),
+            (int)Hash(detailSettings.seed), (int)Hash(detailSettings.seed + 1));
+        target->SetUniform4f("noiseRange", proceduralRange.x, proceduralRange.y, proceduralRange.z, proceduralRange.w);
+        return;
+    }
+
+    shapeTexture->Bind(0);
+    detailTexture->Bind(1);
+    if (densityTexture) densityTexture->Bind(2);
+    target->SetUniform1i("shapeTexture", 0);
+    target->SetUniform1i("detailTexture", 1);
+    target->SetUniform1i("densityTexture", 2);
+    target->SetUniform1i("bakedDensity", densityTexture && (densityMode == 1 || densityMode == 2));
+    target->SetUniform1i("mipLod", mipLod);
+    target->SetUniform1f("detailScale", detailScale);
+}
+void Object::SetSkippingUniforms(Shader* target, glm::vec3 offset)
+{
+    // Macro cell grid of what the shaders sample and the part of the box it leaves active at this
+    // cloudOffset. The procedural noise does not repeat, so it is never skipped. The distance field
+    // is of the baked density, raw noise uses the grid instead.
+    int index = densityTexture && (densityMode == 1 || densityMode == 2) ? 1 : 0;
+    MaxDensityGrid* grid = maxDensityGrid[index];
+    int mode = grid && !proceduralCompiled ? skippingMode : 0;
+    if (mode == 2 && (index == 0 || !distanceField)) mode = 1;
+    target->SetUniform1i("skippingMode", mode);
+    if (mode == 0) return;
+
+    glm::mat4 ModelMatrix = GetModelMatrix();
+    glm::vec3 boxMin = glm::vec3(ModelMatrix * glm::vec4(-1.0f, -1.0f, -1.0f, 1.0f));
+    glm::vec3 boxMax = glm::vec3(ModelMatrix * glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+    glm::vec3 activeMin, activeMax;
+    if (!grid->ActiveBounds(boxMin, boxMax, offset, cloudScale, activeMin, activeMax))
+    {
+        // Inverted bounds, the shaders skip the whole box
+        activeMin = boxMax;
+        activeMax = boxMin;
+    }
+    occupancyTexture[index]->Bind(5);
+    target->SetUniform1i("occupancyGrid", 5);
+    target->SetUniform3f("activeMin", activeMin.x, activeMin.y, activeMin.z);
+    target->SetUniform3f("activeMax", activeMax.x, activeMax.y, activeMax.z);
+    if (mode == 2)
+    {
+        distanceField->Bind(6);
+        target->SetUniform1i("distanceField", 6);
+    }
+}
+void Object::SetDistanceField(DistanceField* field)
+{
+    // Only the texture is kept
+    delete distanceField;
+    distanceField = nullptr;
+    if (field) distanceField = new Texture(field->GetResolution(), field->GetResolution(), GL_R16F, GL_RED, GL_HALF_FLOAT, GL_NEAREST, GL_REPEAT, field->GetData());
+    delete field;
+}
+void Object::SetMaxDensityGrid(int index, MaxDensityGrid* grid)
+{
+    // 0 raw noise, 1 baked density
+    delete maxDensityGrid[index];
+    delete occupancyTexture[index];
+    maxDensityGrid[index] = grid;
+    occupancyTexture[index] = nullptr;
+    if (grid) occupancyTexture[index] = new Texture(grid->GetResolution(), grid->GetResolution(), GL_R8, GL_RED, GL_UNSIGNED_BYTE, GL_NEAREST, GL_REPEAT, grid->GetCells());
+}
+glm::mat4 Object::GetModelMatrix() const
+{
+    glm::mat4 translate = glm::translate(glm::mat4(1.0f), Position);
+    glm::mat4 rotateX = glm::rotate(glm::mat4(1.0f), Rotation.x, glm::vec3(1.0f, 0.0f, 0.0f));
+    glm::mat4 rotateY = glm::rotate(glm::mat4(1.0f), Rotation.y, glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 rotateZ = glm::rotate(glm::mat4(1.0f), Rotation.z, glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::mat4 scale = glm::scale(glm::mat4(1.0f), Scaling);
+    return translate * scale * rotateY * rotateZ * rotateX;
 }
 void Object::Draw()
 {
+    // Offscreen pass, before this object's uniforms are set
+    if (objname == "cloud" && lightVolumeEnabled) UpdateLightVolume();
+
     // Define Model Matrix
     glm::mat4 translate = glm::translate(glm::mat4(1.0f), Position);
     glm::mat4 rotateX = glm::rotate(glm::mat4(1.0f), Rotation.x, glm::vec3(1.0f, 0.0f, 0.0f));
@@ -1594,7 +5510,7 @@ void Object::Draw()
         glm::mat4 RotationMatrix1 = scale1 * rotateY1 * rotateZ1 * rotateX1;
         glm::mat4 ModelMatrix1 = translate1 * RotationMatrix1;
 
-        appState->objects[1]->texture->Bind();
+        appState->objects[1]->SetDensityUniforms(shader);
         shader->SetUniformMatrix4fv("cloudModelMatrix", &ModelMatrix1[0][0]);
         shader->SetUniform3f("cubeMinInitial", -1.0f, -1.0f, -1.0f);
         shader->SetUniform3f("cubeMaxInitial", 1.0f, 1.0f, 1.0f);
@@ -1612,11 +5528,23 @@ void Object::Draw()
     if (objname == "cloud")
     {
         //shader->SetUniformMatrix4fv("rotationMatrix", &ModelMatrix[0][0]);
-        texture->Bind();
+        SetDensityUniforms(shader);
+        lightVolume->Bind(4);
+        shader->SetUniform1i("lightVolume", 4);
+        shader->SetUniform1i("useLightVolume", lightVolumeEnabled);
         shader->SetUniform3f("cubeMinInitial", -1.0f, -1.0f, -1.0f);
         shader->SetUniform3f("cubeMaxInitial",  1.0f,  1.0f,  1.0f);
         shader->SetUniform1f("n_samples", n_samples);
         shader->SetUniform1f("n_lightSamples", n_lightSamples);
+        shader->SetUniform1i("airStride", std::max(airStride, 1));
+        shader->SetUniform1i("lightMarchMode", lightMarchMode);
+        shader->SetUniform1f("pixelSpread", appState->camera->pixelSpread * appState->cloudTarget->factor);
+        shader->SetUniform1i("temporalAccumulation", appState->cloudTarget->temporal || appState->cloudTarget->refine);
+        if (appState->cloudTarget->refine) shader->SetUniform1f("jitterStrength", 1.0f);
+        shader->SetUniform1f("jitterRotation", appState->cloudTarget->JitterRotation());
+        appState->cloudTarget->SetDepthUniforms(shader);
+        glm::vec4 march = appState->cloudTarget->marchTransform;
+        shader->SetUniform4f("marchTransform", march.x, march.y, march.z, march.w);
         shader->SetUniform1f("maxDensity", maxDensity);
         shader->SetUniform1f("falloff", falloff);
         shader->SetUniform1f("cloudScale", cloudScale);
@@ -1628,10 +5556,201 @@ void Object::Draw()
         renderer->Draw(VAO, IBOs[0], shader, "triangles");
     }
 }
+void Object::UpdateLightVolume()
+{
+    // Renders the transmittance from light volume texels to the light, one slice per draw. The volume is
+    // a ring buffer in noise space: when cloudOffset moves by whole texels only the newly exposed slabs are
+    // rendered, everything else is redone only when another input changes.
+    glm::vec3 lightPosition = appState->light->lightPosition;
+    float key[] = { lightPosition.x, lightPosition.y, lightPosition.z,
+        Position.x, Position.y, Position.z, Rotation.x, Rotation.y, Rotation.z, Scaling.x, Scaling.y, Scaling.z,
+        cloudScale, maxDensity, n_lightSamples, detailScale, (float)densityMode, (float)bakedDensityMode, (float)mipLod, (float)proceduralCompiled, transmittanceEpsilon, (float)lightMarchMode };
+    std::vector<float> inputs(key, key + sizeof(key) / sizeof(float));
+    glm::mat4 ModelMatrix = GetModelMatrix();
+
+    glm::ivec3 extent(LightVolumeSize, LightVolumeSize, LightVolumeDepth);
+    glm::vec3 boxSize = glm::vec3(ModelMatrix * glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)) - glm::vec3(ModelMatrix * glm::vec4(-1.0f, -1.0f, -1.0f, 1.0f));
+    glm::vec3 texelSize = boxSize / glm::vec3(extent);
+    glm::ivec3 origin = glm::ivec3(glm::round(cloudOffset / texelSize));
+    glm::ivec3 shift = origin - lightVolumeOrigin;
+    glm::ivec3 wrappedOrigin = ((origin % extent) + extent) % extent; // Storage texel of the box's first texel
+
+    // The view march reads the volume shifted by what is left of cloudOffset past the snapped origin
+    shader->Bind();
+    shader->SetUniform3f("lightVolumeSize", (float)extent.x, (float)extent.y, (float)extent.z);
+    shader->SetUniform3f("lightVolumeOrigin", (float)wrappedOrigin.x, (float)wrappedOrigin.y, (float)wrappedOrigin.z);
+    glm::vec3 residual = (cloudOffset / texelSize - glm::vec3(origin)) / glm::vec3(extent);
+    shader->SetUniform3f("lightVolumeResidual", residual.x, residual.y, residual.z);
+
+    bool loading = progressive[0] || progressive[1];
+    bool full = lightVolumeDirty || loading || inputs != lightVolumeKey ||
+        std::abs(shift.x) >= extent.x || std::abs(shift.y) >= extent.y || std::abs(shift.z) >= extent.z;
+    if (!full && shift == glm::ivec3(0)) return;
+    lightVolumeKey = inputs;
+    lightVolumeDirty = false;
+    lightVolumeOrigin = origin;
+
+    // Texels are lit with the snapped offset so each one stays valid for its point of the noise
+    glm::vec3 snappedOffset = glm::vec3(origin) * texelSize;
+    lightVolumeShader->Bind();
+    SetDensityUniforms(lightVolumeShader);
+    SetSkippingUniforms(lightVolumeShader, snappedOffset);
+    lightVolumeShader->SetUniformMatrix4fv("modelMatrix", &ModelMatrix[0][0]);
+    lightVolumeShader->SetUniform3f("cubeMinInitial", -1.0f, -1.0f, -1.0f);
+    lightVolumeShader->SetUniform3f("cubeMaxInitial", 1.0f, 1.0f, 1.0f);
+    lightVolumeShader->SetUniform3f("lightPosition", lightPosition.x, lightPosition.y, lightPosition.z);
+    lightVolumeShader->SetUniform1f("n_lightSamples", n_lightSamples);
+    lightVolumeShader->SetUniform1i("lightMarchMode", lightMarchMode);
+    lightVolumeShader->SetUniform1f("maxDensity", maxDensity);
+    lightVolumeShader->SetUniform1f("cloudScale", cloudScale);
+    lightVolumeShader->SetUniform3f("cloudOffset", snappedOffset.x, snappedOffset.y, snappedOffset.z);
+    lightVolumeShader->SetUniform3f("lightVolumeSize", (float)extent.x, (float)extent.y, (float)extent.z);
+    lightVolumeShader->SetUniform3f("lightVolumeOrigin", (float)wrappedOrigin.x, (float)wrappedOrigin.y, (float)wrappedOrigin.z);
+
+    // The cloud may be drawn into a reduced resolution target, which is bound again afterwards, and clamped
+    // rays are drawn without the depth test
+    int viewport[4], framebuffer;
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    GLCall(glBindFramebuffer(GL_FRAMEBUFFER, lightVolumeFramebuffer));
+    GLCall(glViewport(0, 0, extent.x, extent.y));
+    GLCall(glDisable(GL_BLEND));
+    GLCall(glDisable(GL_DEPTH_TEST));
+    GLCall(glEnable(GL_SCISSOR_TEST));
+    GLCall(glBindVertexArray(lightVolumeVertexArray));
+
+    // Renders the storage texels from lo up to hi
+    auto drawBlock = [&](glm::ivec3 lo, glm::ivec3 hi)
+    {
+        GLCall(glScissor(lo.x, lo.y, hi.x - lo.x, hi.y - lo.y));
+        for (int slice = lo.z; slice < hi.z; slice++)
+        {
+            GLCall(glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, lightVolume->GetID(), 0, slice));
+            lightVolumeShader->SetUniform1i("lightVolumeSlice", slice);
+            GLCall(glDrawArrays(GL_TRIANGLES, 0, 3));
+        }
+    };
+    if (full)
+    {
+        drawBlock(glm::ivec3(0), extent);
+    }
+    else
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            // Slab that came into the box on the side the offset moved toward, split where storage wraps
+            int count = std::abs(shift[axis]);
+            if (count == 0) continue;
+            int first = (shift[axis] > 0 ? wrappedOrigin[axis] + extent[axis] - count : wrappedOrigin[axis]) % extent[axis];
+            int beforeWrap = std::min(count, extent[axis] - first);
+            glm::ivec3 lo(0), hi = extent;
+            lo[axis] = first;
+            hi[axis] = first + beforeWrap;
+            drawBlock(lo, hi);
+            if (count > beforeWrap)
+            {
+                lo[axis] = 0;
+                hi[axis] = count - beforeWrap;
+                drawBlock(lo, hi);
+            }
+        }
+
+        // Reused texels were lit from where they were in the box when they came in, so while scrolling
+        // one slice per frame is redone as well to keep the path to the box edge and the light current
+        drawBlock(glm::ivec3(0, 0, lightVolumeRefreshSlice), glm::ivec3(extent.x, extent.y, lightVolumeRefreshSlice + 1));
+        lightVolumeRefreshSlice = (lightVolumeRefreshSlice + 1) % extent.z;
+    }
+
+    GLCall(glBindVertexArray(0));
+    GLCall(glDisable(GL_SCISSOR_TEST));
+    if (depthTest)
+    {
+        GLCall(glEnable(GL_DEPTH_TEST));
+    }
+    GLCall(glEnable(GL_BLEND));
+    GLCall(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer));
+    GLCall(glViewport(viewport[0], viewport[1], viewport[2], viewport[3]));
+}
 void Object::Update()
 {
     if (objname == "cloud")
     {
+        previousCloudOffset = cloudOffset;
+
+        // Retune the noise in the background, the current textures stay in use until the new ones are uploaded
+        bool edited = std::memcmp(&shapeEdit, &shapeSettings, sizeof(NoiseSettings)) != 0
+            || std::memcmp(&detailEdit, &detailSettings, sizeof(NoiseSettings)) != 0;
+        bool missing = !shapeTexture && densityMode != 3;
+        bool loading = progressive[0] || progressive[1];
+        if (loading) densityRevision++;
+        if ((edited || missing) && !regeneration && !loading)
+        {
+            shapeSettings = shapeEdit;
+            detailSettings = detailEdit;
+            UpdateProceduralRange();
+            regeneration = new NoiseRegeneration(shapeEdit, detailEdit, detailScale, densityMode, appState->threadPool, appState->computeNoise);
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            if (!progressive[i] || !progressive[i]->Update()) continue;
+
+            // Done, the volume is in the cache now and is mapped back for the CPU density bake
+            delete progressive[i];
+            progressive[i] = nullptr;
+            lightVolumeDirty = true;
+            if (i == 0)
+            {
+                shapeVolume = new NoiseVolume(shapeSettings, appState->threadPool);
+                SetMaxDensityGrid(0, new MaxDensityGrid(*shapeVolume, appState->threadPool));
+            }
+            else detailVolume = new NoiseVolume(detailSettings, appState->threadPool);
+        }
+        if (regeneration && regeneration->Update())
+        {
+            delete shapeTexture;
+            delete detailTexture;
+            delete densityTexture;
+            delete shapeVolume;
+            delete detailVolume;
+
+            lightVolumeDirty = true;
+            densityRevision++;
+            shapeTexture = regeneration->ReleaseTexture(0);
+            detailTexture = regeneration->ReleaseTexture(1);
+            densityTexture = regeneration->ReleaseTexture(2);
+            bakedDensityMode = densityTexture ? regeneration->densityMode : 0;
+            shapeVolume = regeneration->shapeVolume;
+            detailVolume = regeneration->detailVolume;
+            regeneration->shapeVolume = nullptr;
+            regeneration->detailVolume = nullptr;
+            for (int i = 0; i < 2; i++)
+            {
+                SetMaxDensityGrid(i, regeneration->maxDensityGrid[i]);
+                regeneration->maxDensityGrid[i] = nullptr;
+            }
+            SetDistanceField(regeneration->distanceField);
+            regeneration->distanceField = nullptr;
+
+            delete regeneration;
+            regeneration = nullptr;
+        }
+
+        BakeDensity();
+
+        // The procedural variant is compiled in, and stays in while there are no textures to sample
+        bool procedural = densityMode == 3 || !shapeTexture;
+        if (procedural != proceduralCompiled)
+        {
+            std::vector<std::string> defines;
+            if (procedural) defines.push_back("PROCEDURAL_DENSITY");
+            shader->Compile(defines);
+            appState->objects[0]->shader->Compile(defines);
+            defines.push_back("LIGHT_VOLUME_PASS");
+            lightVolumeShader->Compile(defines);
+            proceduralCompiled = procedural;
+        }
+
         if (play) {
             cloudOffset.y = cloudOffset.y - appState->deltaTime * 0.8f;
             cloudOffset.x = cloudOffset.x + appState->deltaTime * 0.4f;
@@ -1724,6 +5843,16 @@ Camera::Camera(App* app)
     r = 41.409f;
     theta = 1.192f;
     phi = 0.0f;
+    pixelSpread = 0.0f;
+    zNear = 0.1f;
+    zFar = 1000.0f;
+    cameraMatrix = previousCameraMatrix = glm::mat4(1.0f);
+}
+void Camera::UpdatePosition()
+{
+    camPosition.x = r * std::cos(phi) * std::sin(theta);
+    camPosition.y = r * std::sin(phi) * std::sin(theta);
+    camPosition.z = r * std::cos(theta);
 }
 void Camera::Update()
 {
@@ -1735,24 +5864,254 @@ void Camera::Update()
 
     glm::vec3 up = glm::vec3(0.0f, 0.0f, 1.0f);
     glm::mat4 viewMatrix = glm::lookAt(camPosition, targetPoint, up);
-    glm::mat4 projectionMatrix = glm::perspective(45.0f, (float)height / width, 0.1f, 1000.0f);
-    glm::mat4 camMatrix = projectionMatrix * viewMatrix;
+    glm::mat4 projectionMatrix = glm::perspective(45.0f, (float)height / width, zNear, zFar);
+    previousCameraMatrix = cameraMatrix;
+    cameraMatrix = projectionMatrix * viewMatrix;
+    pixelSpread = 2.0f / (projectionMatrix[1][1] * height);
 
     // Set uniforms
     for (int i = 1; i < shaders.size(); i++)
     {
         shaders[i]->Bind();
-        shaders[i]->SetUniformMatrix4fv("cameraMatrix", &camMatrix[0][0]);
+        shaders[i]->SetUniformMatrix4fv("cameraMatrix", &cameraMatrix[0][0]);
         if (i != 3) {
             shaders[i]->SetUniform3f("cameraPosition", camPosition.x, camPosition.y, camPosition.z);
         }
     }
 }
 
-int main(void)
+void NoiseBenchmark(ThreadPool* pool)
+{
+    // Voxels per second of the Worley row kernel, scalar against SIMD, on one thread and on the pool
+    const int res = 128;
+    const int frequencies[4] = { 4, 8, 16, 32 };
+    std::vector<float> scalarResult(res * res * res);
+    std::vector<float> simdResult(res * res * res);
+
+    std::cout << "Worley kernel benchmark, " << res << "^3 voxels, SIMD: " << WorleySimdName()
+        << ", threads: " << pool->GetThreadCount() << std::endl;
+
+    for (int f = 0; f < 4; f++)
+    {
+        FeaturePointGrid grid(frequencies[f], 1);
+        for (int threaded = 0; threaded <= 1; threaded++)
+        {
+            for (int simd = 0; simd <= 1; simd++)
+            {
+                float* out = simd ? simdResult.data() : scalarResult.data();
+                float best = std::numeric_limits<float>::max();
+                for (int run = 0; run < 3; run++)
+                {
+                    auto start = std::chrono::high_resolution_clock::now();
+                    ParallelFor(threaded ? pool : nullptr, res * res, [&](int row)
+                    {
+                        int j = row % res, k = row / res;
+                        WorleyRow(grid, res, res, res, j, k, 0, res, &out[res * row], 1, simd == 1);
+                    });
+                    auto end = std::chrono::high_resolution_clock::now();
+                    best = std::min(best, std::chrono::duration<float>(end - start).count());
+                }
+                std::cout << "  freq " << frequencies[f] << (threaded ? ", pool  " : ", 1 thread") << (simd ? ", simd  : " : ", scalar: ")
+                    << (res * res * res) / best / 1.0e6f << " Mvoxels/s" << std::endl;
+            }
+        }
+        if (scalarResult != simdResult) std::cout << "  freq " << frequencies[f] << ": SIMD result differs from scalar!" << std::endl;
+    }
+
+    // Whole volume per backend, same settings as the cloud texture
+    NoiseSettings settings;
+    settings.resolution = res;
+    settings.channels = 4;
+    settings.frequency[0] = 4;
+    settings.frequency[1] = 8;
+    settings.frequency[2] = 16;
+    settings.frequency[3] = 32;
+    settings.octaves = 3;
+    settings.seed = 1;
+
+    std::cout << "Noise generator benchmark, " << res << "^3 x 4 channels, " << settings.octaves << " octaves" << std::endl;
+    for (int g = 0; g < NumNoiseGenerators; g++)
+    {
+        settings.generator = g;
+        NoiseGenerator* generator = NoiseGenerator::Create(settings);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        unsigned char* texels = generator->Generate(pool);
+        auto end = std::chrono::high_resolution_clock::now();
+        float seconds = std::chrono::duration<float>(end - start).count();
+
+        // Slab by slab, where every generator but Worley pays a full range pass before the texels
+        const int slabDepth = 16;
+        std::vector<float> scratch((size_t)res * res * slabDepth * 4);
+        std::vector<unsigned char> slabTexels((size_t)res * res * slabDepth * settings.channels);
+        float scale[4], bias[4];
+        start = std::chrono::high_resolution_clock::now();
+        generator->BeginSlabs(pool, slabDepth, scratch.data(), scale, bias);
+        for (int startZ = 0; startZ < res; startZ += slabDepth)
+            generator->GenerateSlabTexels(pool, startZ, std::min(startZ + slabDepth, res), scratch.data(), scale, bias, slabTexels.data());
+        end = std::chrono::high_resolution_clock::now();
+        float slabSeconds = std::chrono::duration<float>(end - start).count();
+
+        std::cout << "  " << generator->GetName() << ": " << seconds * 1000.0f << " ms, "
+            << (res * res * res) / seconds / 1.0e6f << " Mvoxels/s, slab by slab " << slabSeconds * 1000.0f << " ms" << std::endl;
+        delete[] texels;
+        delete generator;
+    }
+}
+
+int VerifyComputeNoise(ThreadPool* pool)
+{
+    // Compares the compute shader path with the CPU generator on a hidden 4.3 context.
+    // Texels may differ by one step of 8 bit rounding, anything more is a failure.
+    // Without a 4.3 context there is nothing to compare, so the check is skipped rather than failed.
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(64, 64, "Noise check", NULL, NULL);
+    if (!window)
+    {
+        std::cout << "No OpenGL 4.3 context, compute noise not checked" << std::endl;
+        glfwTerminate();
+        return 0;
+    }
+    glfwMakeContextCurrent(window);
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress) || !LoadComputeFunctions((GLADloadproc)glfwGetProcAddress))
+    {
+        std::cout << "Compute shaders unavailable, compute noise not checked" << std::endl;
+        glfwTerminate();
+        return 0;
+    }
+    std::cout << "Checking compute noise on " << glGetString(GL_RENDERER) << std::endl;
+
+    const int maxTexelError = 1;
+    const int maxDensityError = 2;
+    bool passed = true;
+    {
+        ComputeNoise computeNoise;
+
+        typedef struct
+        {
+            int resolution, channels;
+            int frequency[4];
+            unsigned int seed;
+        }NoiseCase;
+        NoiseCase cases[] = {
+            { 128, 2, { 4, 8, 0, 0 }, 1 },
+            { 32, 2, { 4, 8, 0, 0 }, 2 },
+            { 64, 4, { 4, 8, 16, 32 }, 7 },
+            { 40, 1, { 3, 0, 0, 0 }, 11 },
+        };
+        const GLenum formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+
+        std::vector<std::vector<unsigned char>> cpuTexels;
+        std::vector<Texture*> gpuTextures;
+        for (int c = 0; c < 4; c++)
+        {
+            NoiseSettings settings;
+            settings.generator = 0;
+            settings.resolution = cases[c].resolution;
+            settings.channels = cases[c].channels;
+            for (int i = 0; i < 4; i++) settings.frequency[i] = cases[c].frequency[i];
+            settings.octaves = 3;
+            settings.seed = cases[c].seed;
+            size_t bytes = NoiseVolumeBytes(settings);
+
+            auto start = std::chrono::high_resolution_clock::now();
+            NoiseGenerator* generator = NoiseGenerator::Create(settings);
+            unsigned char* cpu = generator->Generate(pool);
+            auto mid = std::chrono::high_resolution_clock::now();
+            Texture* gpu = computeNoise.GenerateWorley(settings);
+            glFinish();
+            auto end = std::chrono::high_resolution_clock::now();
+
+            std::vector<unsigned char> readBack(bytes);
+            gpu->GetImage(0, formats[settings.channels - 1], GL_UNSIGNED_BYTE, readBack.data());
+
+            int maxError = 0;
+            size_t over = 0;
+            for (size_t i = 0; i < bytes; i++)
+            {
+                int error = std::abs((int)cpu[i] - (int)readBack[i]);
+                maxError = std::max(maxError, error);
+                if (error > maxTexelError) over++;
+            }
+            passed = passed && maxError <= maxTexelError;
+            std::cout << "Worley " << settings.resolution << "^3 x" << settings.channels << ": max error " << maxError
+                << ", " << over << " texels over tolerance, CPU " << std::chrono::duration<float, std::milli>(mid - start).count()
+                << " ms, GPU " << std::chrono::duration<float, std::milli>(end - mid).count() << " ms" << std::endl;
+
+            cpuTexels.push_back(std::vector<unsigned char>(cpu, cpu + bytes));
+            gpuTextures.push_back(gpu);
+            delete[] cpu;
+            delete generator;
+        }
+
+        // Density bake of the first two cases, the default shape and detail volumes
+        {
+            NoiseSettings shapeSettings, detailSettings;
+            shapeSettings.generator = detailSettings.generator = 0;
+            shapeSettings.resolution = 128;
+            detailSettings.resolution = 32;
+            shapeSettings.channels = detailSettings.channels = 2;
+            shapeSettings.octaves = detailSettings.octaves = 3;
+            for (int i = 0; i < 4; i++) shapeSettings.frequency[i] = detailSettings.frequency[i] = cases[0].frequency[i];
+            shapeSettings.seed = 1;
+            detailSettings.seed = 2;
+
+            NoiseVolume shape(shapeSettings, pool), detail(detailSettings, pool);
+            DensityVolume cpu(shape, detail, 4.0f, false, pool);
+            Texture* gpu = computeNoise.BakeDensity(gpuTextures[0], gpuTextures[1], 128, 4.0f, false);
+
+            std::vector<unsigned char> readBack(cpu.GetBytes());
+            gpu->GetImage(0, GL_RED, GL_UNSIGNED_BYTE, readBack.data());
+            const unsigned char* expected = (const unsigned char*)cpu.GetData();
+            int maxError = 0;
+            for (size_t i = 0; i < readBack.size(); i++) maxError = std::max(maxError, std::abs((int)expected[i] - (int)readBack[i]));
+            passed = passed && maxError <= maxDensityError;
+            std::cout << "Density bake 128^3 R8: max error " << maxError << std::endl;
+            delete gpu;
+        }
+
+        for (size_t i = 0; i < gpuTextures.size(); i++) delete gpuTextures[i];
+    }
+
+    std::cout << (passed ? "Compute noise matches the CPU generator" : "Compute noise DOES NOT match the CPU generator") << std::endl;
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return passed ? 0 : 1;
+}
+int main(int argc, char** argv)
 {
     std::srand(static_cast<unsigned int>(std::time(nullptr)));
 
-    App app;
+    if (argc > 1 && std::string(argv[1]) == "--benchmark-noise")
+    {
+        ThreadPool pool;
+        NoiseBenchmark(&pool);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--generate-blue-noise")
+    {
+        // Offline bake of the blue noise tables into the cache, the app loads them at startup
+        ThreadPool pool;
+        BlueNoise spatial(128, 1, 1, &pool);
+        BlueNoise spatiotemporal(64, 16, 1, &pool);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--verify-noise")
+    {
+        ThreadPool pool;
+        return VerifyComputeNoise(&pool);
+    }
+    bool benchmark = false, procedural = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--benchmark-render") benchmark = true;
+        if (std::string(argv[i]) == "--procedural-density") procedural = true;
+    }
+
+    App app(benchmark, procedural);
     return 0;
 }